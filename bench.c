@@ -0,0 +1,266 @@
+#include "bwt.h"
+
+// Measure the latency of 'get_rank()' on the index loaded with each
+// policy of 'load_index()'. Dependent ranks (each position is computed
+// from the previous rank) show the latency of a miss, independent
+// ranks show the throughput when the misses overlap.
+
+size_t
+anon_huge_kb
+(void)
+// Anonymous memory of the process backed by transparent huge pages.
+{
+   size_t kb = 0;
+   FILE * f = fopen("/proc/self/smaps_rollup", "r");
+   if (f == NULL) return 0;
+   char line[256];
+   while (fgets(line, sizeof(line), f) != NULL)
+      if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) break;
+   fclose(f);
+   return kb;
+}
+
+
+char *
+sample_reads
+(
+   const index_t * idx,
+   const size_t    n,
+   const size_t    len
+)
+// Sample 'n' substrings of the text of size 'len' by walking
+// the BWT backward from random rows.
+{
+   char * reads = malloc(n * len);
+   exit_on_memory_error(reads);
+   const bwt_t * bwt = idx->bwt;
+   size_t x = 2463534242ULL;
+   for (size_t i = 0 ; i < n ; i++) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      size_t row = x % bwt->txtlen;
+      for (size_t j = 0 ; j < len ; j++) {
+         // Restart at the beginning of the text.
+         if (row == bwt->zero) row = x % bwt->zero, j = 0;
+         const int c = get_symbol(bwt, idx->occ, row);
+         reads[i*len + len-j-1] = ALPHABET[c];
+         row = get_rank(idx->occ, c, row) - 1;
+      }
+   }
+   return reads;
+}
+
+
+range_t
+search_steps
+(
+   const index_t * idx,
+   const char    * query,
+   const size_t    len,
+   const int       paired,
+         size_t  * nsteps,
+         size_t  * nsame
+)
+// Same as 'backward_search()', with the ranks at both ends of the
+// range taken separately or with 'get_rank_range()'. The steps
+// where both ends are in the same entry are counted.
+{
+   const occ_t * occ = idx->occ;
+   const lut_t * lut = idx->lut;
+   const size_t width = occ->layout == OCC_PACKED ? 192 : 32;
+   // Without lookup table, start from the full range.
+   range_t range = { .bot = 0, .top = occ->txtlen-1 };
+   size_t offset = 0;
+   if (lut != NULL && len >= lut->k) {
+      size_t merid = 0;
+      for (int i = 0 ; i < lut->k ; i++)
+         merid = (merid << 2) + ENCODE[(uint8_t) query[len-lut->k+i]];
+      range = lookup_lut(lut, merid);
+      offset = lut->k;
+   }
+   for ( ; offset < len ; offset++) {
+      if (range.top < range.bot) break;
+      const int c = ENCODE[(uint8_t) query[len-offset-1]];
+      (*nsteps)++;
+      *nsame += range.bot > 0 && (range.bot-1) / width == range.top / width;
+      if (paired) {
+         range = get_rank_range(occ, c, range);
+      }
+      else {
+         range.bot = range.bot > 0 ?
+            get_rank(occ, c, range.bot - 1) : occ->C[c];
+         range.top = get_rank(occ, c, range.top) - 1;
+      }
+   }
+   return range;
+}
+
+
+double
+now
+(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char ** argv) {
+
+   char * usage = "usage: bench [-n ranks] genome.fasta";
+   size_t n = 10000000;
+   int opt;
+   while ((opt = getopt(argc, argv, "n:")) != -1) {
+      if (opt == 'n' && atol(optarg) > 0) n = atol(optarg);
+      else {
+         fprintf(stderr, "%s\n", usage);
+         exit(EXIT_FAILURE);
+      }
+   }
+   if (argc - optind != 1) {
+      fprintf(stderr, "%s\n", usage);
+      exit(EXIT_FAILURE);
+   }
+   exit_if(strlen(argv[optind]) > 250);
+
+   char buff[256];
+   sprintf(buff, "%s.idx", argv[optind]);
+
+   const char * names[] = { "populate", "lazy", "copy", "hugetlb",
+      "hugetlb1g", "shared" };
+
+   for (int policy = 0 ; policy < 6 ; policy++) {
+
+      index_t idx;
+      if (load_index(buff, policy, &idx) != 0) {
+         fprintf(stdout, "%-10s unavailable\n", names[policy]);
+         continue;
+      }
+
+      const occ_t * occ = idx.occ;
+      const size_t txtlen = occ->txtlen;
+
+      // Dependent ranks.
+      size_t x = 88172645463325252ULL;
+      size_t pos = 0;
+      double t0 = now();
+      for (size_t i = 0 ; i < n ; i++) {
+         x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+         pos = (x + get_rank(occ, x & 3, pos)) % txtlen;
+      }
+      const double dep = (now() - t0) * 1e9 / n;
+
+      // Independent ranks.
+      size_t sum = pos;
+      t0 = now();
+      for (size_t i = 0 ; i < n ; i++) {
+         x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+         sum += get_rank(occ, x & 3, (x >> 2) % txtlen);
+      }
+      const double ind = (now() - t0) * 1e9 / n;
+
+      fprintf(stdout, "%-10s load %.3f s, %zu MB resident, "
+            "%zu MB anon huge, %.1f ns/rank dependent, "
+            "%.1f ns/rank independent (%zu)\n", names[policy],
+            idx.loadtime, idx.resident >> 20, anon_huge_kb() >> 10,
+            dep, ind, sum & 1);
+
+      unload_index(&idx);
+
+   }
+
+   // Search reads of the text one by one and by batches.
+   index_t idx;
+   exit_if(load_index(buff, LOAD_POPULATE, &idx) != 0);
+
+   const size_t nreads = n / 10;
+   const size_t len = 32;
+   char * reads = sample_reads(&idx, nreads, len);
+   const char ** query = malloc(nreads * sizeof(char *));
+   size_t * lens = malloc(nreads * sizeof(size_t));
+   range_t * range = malloc(nreads * sizeof(range_t));
+   exit_on_memory_error(query);
+   exit_on_memory_error(lens);
+   exit_on_memory_error(range);
+   for (size_t i = 0 ; i < nreads ; i++) {
+      query[i] = reads + i*len;
+      lens[i] = len;
+   }
+
+   double t0 = now();
+   for (size_t i = 0 ; i < nreads ; i++)
+      range[i] = backward_search(query[i], len, idx.occ, idx.lut);
+   const double scalar = (now() - t0) * 1e9 / nreads;
+
+   size_t hits = 0;
+   for (size_t i = 0 ; i < nreads ; i++)
+      hits += range[i].top >= range[i].bot;
+
+   t0 = now();
+   backward_search_batch(query, lens, nreads, idx.occ, idx.lut, range);
+   const double batch = (now() - t0) * 1e9 / nreads;
+
+   for (size_t i = 0 ; i < nreads ; i++)
+      hits -= range[i].top >= range[i].bot;
+   exit_if(hits != 0);
+
+   // All the ranks at a position, at once and one by one.
+   size_t x = 88172645463325252ULL;
+   size_t sum = 0;
+   t0 = now();
+   for (size_t i = 0 ; i < nreads ; i++) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      size_t rank[SIGMA];
+      get_rank_all(idx.occ, x % idx.occ->txtlen, rank);
+      sum += rank[0] + rank[1] + rank[2] + rank[3];
+   }
+   const double all = (now() - t0) * 1e9 / nreads;
+
+   x = 88172645463325252ULL;
+   t0 = now();
+   for (size_t i = 0 ; i < nreads ; i++) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      for (int c = 0 ; c < SIGMA ; c++)
+         sum -= get_rank(idx.occ, c, x % idx.occ->txtlen);
+   }
+   const double each = (now() - t0) * 1e9 / nreads;
+   exit_if(sum != 0);
+
+   const char * layouts[] = { "split", "interleaved", "packed" };
+   fprintf(stdout, "rank all   layout %s, %zu MB Occ table, %.1f ns "
+         "get_rank_all, %.1f ns 4 x get_rank\n",
+         layouts[idx.occ->layout], occ_size(idx.occ) >> 20, all, each);
+
+   // Share of the steps where both ends of the range are in the
+   // same entry, and time with and without 'get_rank_range()'. The
+   // two are alternated and the best of 3 rounds is kept.
+   size_t nsteps = 0;
+   size_t nsame = 0;
+   double split[2] = { 1e12, 1e12 };
+   for (int round = 0 ; round < 6 ; round++) {
+      const int paired = round % 2;
+      t0 = now();
+      for (size_t i = 0 ; i < nreads ; i++) {
+         range_t r = search_steps(&idx, query[i], len, paired,
+               &nsteps, &nsame);
+         exit_if(r.bot != range[i].bot);
+      }
+      const double t = (now() - t0) * 1e9 / nreads;
+      if (t < split[paired]) split[paired] = t;
+   }
+
+   fprintf(stdout, "pairs      %.1f%% of %zu steps in one entry, "
+         "%.1f ns/read separate, %.1f ns/read paired\n",
+         100.0 * nsame / nsteps, nsteps / 6, split[0], split[1]);
+
+   fprintf(stdout, "search     %zu reads of %zu nt, %.1f ns/read scalar, "
+         "%.1f ns/read batch (%d lanes)\n", nreads, len, scalar, batch,
+         LANES);
+
+   free(range);
+   free(lens);
+   free(query);
+   free(reads);
+   unload_index(&idx);
+
+}
@@ -1,108 +1,8 @@
-#include "divsufsort.h"
 #include "bwt.h"
+#include "divsufsort.h"
 
 
-// SECTION 1. MACROS //
-
-// Size of the alphabet. Note that the code will break if
-// the value is changed. It is indicated here in order
-// to highlight where the alphabet size is important.
-
-#define SIGMA 4
-
-// Error-handling macros.
-#define exit_on_memory_error(x) \
-   do { if ((x) == NULL) { fprintf(stderr, "memory error %s:%d:%s()\n", \
-         __FILE__, __LINE__, __func__); exit(EXIT_FAILURE); }} while(0)
-
-
-// SECTION 2. TYPE DEFINITIONS //
-
-typedef struct blocc_t  blocc_t;
-typedef struct csa_t    csa_t;
-typedef struct bwt_t    bwt_t;
-typedef struct lut_t    lut_t;
-typedef struct occ_t    occ_t;
-typedef struct range_t  range_t;
-typedef unsigned int    uint_t;
-
-
-// Entries of the Occ table combine an Occ value (the cumulative
-// number of occurrences of the character in the BWT up to and
-// including the given position), and a bitfield where the value
-// is set to 1 if and only if the BWT has the character at this
-// position.
-//
-// Example 'blocc_t' data:
-//
-//  |  .smpl (uint32_t)  |          .bits (uint32_t)          |
-//  |       146883       | 0b00100011100000000110000001000000 |
-//
-// The next .smpl value in an array of 'blocc_t' must be 146890
-// (the popcount of the contiguous .bits value).
-//
-// To avoid confusion, we will use the term "index" when referring
-// to 'blocc_t' structs of an array, and "position" when referring
-// to the text or the BWT. Thus, the rank is taken on a position
-// and not an index.
-//
-// There is one 'blocc_t' per 32 letters of the BWT. Since each
-// 'blocc_t' occupies 64 bits, an array of 'blocc_t' occupies
-// 2 bits per letter of the BWT. Since there is one array per
-// symbol of the alphabet, an Occ table occupies '2*SIGMA' bits per
-// letter of the BWT (i.e. one byte when 'SIGMA' is 4).
-//
-// Both .smpl and .bits are retrieved in a single memory reference
-// (a 'blocc_t' occupies 8 bytes and cache lines are 64 bytes on
-// x86), so both values are available for the price of a single
-// cache miss.
-
-struct blocc_t {
-   uint_t smpl : 32;    // Sampled Occ values.
-   uint_t bits : 32;    // Bitfield Occ values.
-};
-
-// Return type for range queries.
-struct range_t {
-   size_t bot;
-   size_t top;
-};
-
-// The 'Occ_t' struct contains a size variable 'sz', followed by
-// 'SIGMA' arrays of 'blocc_t', where 'SIGMA' is the number of
-// letters in the alphabet. Note that 'sz' is not the number of
-// 'blocc_t' in the arrays, but the size of the BWT, including the
-// termination character.
-struct occ_t {
-   size_t   txtlen;      // 'strlen(txt) + 1'.
-   size_t   C[SIGMA+1];  // The 'C' array.
-   size_t   nrows;       // Number of entries.
-   blocc_t  rows[0];     // Occ entries.
-};
-
-// The compressed suffix array.
-struct csa_t {
-   size_t    nbits;      // Bits in encoding.
-   uint64_t  bmask;      // Bit mask (lower nbits set to 1).
-   size_t    nint64;     // Size of the bit field.
-   int64_t   bitf[0];    // Bie field.
-};
-
-// The Burrow-Wheeler transform.
-struct bwt_t {
-   size_t   txtlen;      // 'strlen(txt) + 1'.
-   size_t   zero;        // Position of '$'.
-   size_t   nslots;      // Number of slots.
-   uint8_t  slots[0];    // 2-bit characters.
-};
-
-// Lookup table 
-#define LUTK 12  // Size of k-mers in the LUT.
-struct lut_t { range_t kmer[1<<(2*LUTK)]; };
-
-
-
-// SECTION 3. GLOBAL CONSTANTS OF INTEREST //
+// SECTION 1. GLOBAL CONSTANTS OF INTEREST //
 
 const char ALPHABET[4] = "ACGT";
 const char ENCODE[256] = { ['c'] = 1, ['g'] = 2, ['t'] = 3,
@@ -148,9 +48,9 @@ const char REVCOMP[256] = {
 
 
 
-// SECTION 4. FUNCTION DEFINITIONS //
+// SECTION 2. FUNCTION DEFINITIONS //
 
-// SECTION 4.1 INDEXING FUNCTIONS //
+// SECTION 2.1 INDEXING FUNCTIONS //
 
 int64_t *
 compute_sa
@@ -158,284 +58,3307 @@ compute_sa
    const char * txt
 )
 {
+   return compute_sa_mt(txt, 1);
+}
 
-   const size_t txtlen = strlen(txt) + 1;
-   int64_t *array = malloc(txtlen * sizeof(uint64_t));
-   exit_on_memory_error(array);
 
-   divsufsort((const unsigned char *) txt, array, txtlen);
-   return array;
+// Suffixes are bucketed by their first 'SORTK' characters
+// for block-wise sorting. There are 5^SORTK buckets because
+// the terminator is counted as a fifth symbol.
+#define SORTK 8
+#define NBUCKETS 390625
+
+// Code of the symbols in base 5 (the terminator is 0).
+static const uint8_t CODE5[256] = { ['A'] = 1, ['C'] = 2,
+   ['G'] = 3, ['T'] = 4 };
+
+
+// Suffixes that share more than 'v' characters are compared with
+// a difference cover sample, as in Kärkkäinen's blockwise suffix
+// sorting. The cover 'D' of Z/vZ is { 0, ..., m-1 } together with
+// { m, 2m, ..., v-m } where v = m^2, so that for any 'i' and 'j'
+// there is a 'd < v' such that both 'i+d' and 'j+d' are in 'D'
+// modulo 'v'. The suffixes starting at positions in 'D' modulo 'v'
+// are ranked in advance.
+typedef struct dcover_t dcover_t;
+
+struct dcover_t {
+   const char * txt;
+   size_t       txtlen;
+   size_t       m;        // Square root of 'v', a power of 2.
+   int          lgm;      // Log2 of 'm'.
+   size_t       v;        // Period of the cover.
+   size_t       nd;       // Size of the cover ('2m-1').
+   size_t     * off;      // Offset of each residue in 'rank'.
+   uint32_t   * rank;     // Ranks of the sampled suffixes.
+};
+
 
+size_t
+dc_index
+(
+   const dcover_t * dc,
+         size_t     r
+)
+// Index of residue 'r' in the cover, or 'nd' if 'r' is not in it.
+{
+   if (r < dc->m) return r;
+   if ((r & (dc->m - 1)) == 0) return dc->m - 1 + (r >> dc->lgm);
+   return dc->nd;
 }
 
 
-csa_t *
-compress_sa
+size_t
+dc_residue
 (
-   int64_t * sa
+   const dcover_t * dc,
+         size_t     idx
 )
+// Residue of the cover at index 'idx'.
 {
+   return idx < dc->m ? idx : (idx - dc->m + 1) * dc->m;
+}
 
-   // The first entry of the suffix array is the length of the text.
-   size_t txtlen = sa[0] + 1;
 
-   // Compute the number of required bits.
-   size_t nbits = 0;
-   while (txtlen > ((uint64_t) 1 << nbits)) nbits++;
+size_t
+dc_at
+(
+   const dcover_t * dc,
+         size_t     pos
+)
+// Index of the sampled suffix at 'pos' in 'rank'.
+{
+   return dc->off[dc_index(dc, pos & (dc->v - 1))] + (pos >> 2*dc->lgm);
+}
 
-   // Compute the number of required bytes and 'uint64_t'.
-   size_t nnumb = (txtlen + (16-1)) / 16;
-   size_t nint64 = (nbits * nnumb + (64-1)) / 64;
-   csa_t * csa = calloc(1, sizeof(csa_t) + nint64 * 8);
 
-   csa->nbits = nbits;
-   csa->nint64 = nint64;
+int
+dc_compare
+(
+   const void * a,
+   const void * b,
+         void * arg
+)
+// Compare two suffixes known to share their first 'v' characters.
+{
+   const dcover_t * dc = arg;
+   const size_t i = *(const int64_t *) a;
+   const size_t j = *(const int64_t *) b;
+   // Find 'd' such that 'i+d' and 'j+d' are both in the cover.
+   const size_t k = (j - i) & (dc->v - 1);
+   const size_t r = k & (dc->m - 1);
+   const size_t d = ((r ? dc->m - r : 0) - i) & (dc->v - 1);
+   const size_t pi = i + d;
+   const size_t pj = j + d;
+   uint32_t ri = dc->rank[dc_at(dc, pi)];
+   uint32_t rj = dc->rank[dc_at(dc, pj)];
+   return (ri > rj) - (ri < rj);
+}
 
-   // Set a mask for the 'nbits' lower bits.
-   csa->bmask = ((uint64_t) 0xFFFFFFFFFFFFFFFF) >> (64-nbits);
-   
-   uint8_t lastbit = 0;
-   size_t  nb = 0;
-   // Sample every 16-th value.
-   for (size_t pos = 0 ; pos < txtlen ; pos += 16) {
-      int64_t current = sa[pos];
-      // Store the compact representation.
-      csa->bitf[nb] |= current << lastbit;
-      // Update bit offset.
-      lastbit += nbits;
-      // Check if word is full.
-      if (lastbit >= 64) {
-         lastbit = lastbit - 64;
-         // Complete with remainder or set to 0 (if lastbit = 0).
-         // This will clear the upper bits of array.
-         csa->bitf[++nb] = current >> (nbits - lastbit);
-      }
-   }
 
-   return csa;
+int
+compare_suffixes
+(
+   const dcover_t * dc,
+         size_t     i,
+         size_t     j,
+         size_t     depth
+)
+// Compare two suffixes that share their first 'depth' characters.
+// Suffixes that share 'v' characters are equal if the sample
+// is not ranked yet.
+{
+   int cmp = strncmp(dc->txt + i + depth, dc->txt + j + depth,
+         dc->v - depth);
+   if (cmp != 0 || dc->rank == NULL) return cmp;
+   int64_t a = i, b = j;
+   return dc_compare(&a, &b, (void *) dc);
+}
+
+
+// Characters skipped at once by 'sort_suffixes()' in repeats.
+#define SKIP 64
+
 
+size_t
+common_prefix
+(
+   const dcover_t * dc,
+   const int64_t  * sfx,
+   const size_t     n,
+   const size_t     depth,
+         size_t     max
+)
+// Number of characters (up to 'max') that the suffixes in 'sfx'
+// share after their first 'depth' characters. The suffixes are
+// compared 8 characters at a time with the first one, and the scan
+// stops as soon as one of them differs on the next character.
+{
+   const char * txt = dc->txt;
+   const size_t a = sfx[0] + depth;
+   for (size_t i = 1 ; i < n && max > 0 ; i++) {
+      const size_t b = sfx[i] + depth;
+      size_t k = 0;
+      // The words stop before the end of the text.
+      while (k + 8 <= max && (a > b ? a : b) + k + 8 <= dc->txtlen) {
+         uint64_t x, y;
+         memcpy(&x, txt + a + k, 8);
+         memcpy(&y, txt + b + k, 8);
+         if (x != y) break;
+         k += 8;
+      }
+      // The terminator is unique, so it stops the comparison.
+      while (k < max && txt[a+k] == txt[b+k]) k++;
+      max = k;
+   }
+   return max;
 }
 
 
-bwt_t *
-create_bwt
+void
+sort_suffixes
 (
-   const char    * txt,
-   const int64_t * sa
+   const dcover_t * dc,
+         int64_t  * sfx,
+         uint8_t  * tie,
+         size_t     n,
+         size_t     depth
 )
+// Sort the suffixes of 'dc->txt' starting at the positions in 'sfx',
+// knowing that they share their first 'depth' characters. This is a
+// multikey quicksort (Bentley & Sedgewick): partition on the
+// character at 'depth', sort the smaller and larger parts, and move
+// on to the next character in the middle part, up to depth 'v'.
+// If the sample is not ranked yet, the suffixes equal up to depth
+// 'v' are left in place and flagged in 'tie' (the first suffix of
+// such a group is not flagged).
 {
 
-   // Allocate new 'bwt_t'.
-   const size_t txtlen = strlen(txt) + 1;           // Do not forget $.
-   const size_t nslots = (txtlen + (4-1)) / 4;
-   const size_t extra = nslots * sizeof(uint8_t);
+   const char * txt = dc->txt;
 
-   bwt_t *bwt = calloc(1, sizeof(bwt_t) + extra);
-   exit_on_memory_error(bwt);
+   while (n > 1) {
 
-   bwt->txtlen = txtlen;
-   bwt->nslots = nslots;
+      if (depth >= dc->v) {
+         if (dc->rank != NULL) {
+            qsort_r(sfx, n, sizeof(int64_t), dc_compare, (void *) dc);
+         }
+         else {
+            memset(tie + 1, 1, n - 1);
+         }
+         return;
+      }
 
-   // Encode characters with 2 bits.
-   for (size_t pos = 0 ; pos < txtlen ; pos++) {
-      if (sa[pos] > 0) { 
-         uint8_t c = ENCODE[(uint8_t) txt[sa[pos]-1]];
-         bwt->slots[pos/4] |= c << 2*(pos % 4);
+      if (n < 16) {
+         // Insertion sort for small arrays.
+         for (size_t i = 1 ; i < n ; i++) {
+            int64_t tmp = sfx[i];
+            size_t j = i;
+            for ( ; j > 0 ; j--) {
+               if (compare_suffixes(dc, sfx[j-1], tmp, depth) <= 0) break;
+               sfx[j] = sfx[j-1];
+            }
+            sfx[j] = tmp;
+         }
+         if (dc->rank == NULL) {
+            for (size_t i = 1 ; i < n ; i++)
+               tie[i] = compare_suffixes(dc, sfx[i-1], sfx[i], depth) == 0;
+         }
+         return;
       }
-      else {
-         // Record the position of the zero.
-         bwt->zero = pos;
+
+      // Median of three for the pivot.
+      uint8_t a = txt[sfx[0]+depth];
+      uint8_t b = txt[sfx[n/2]+depth];
+      uint8_t c = txt[sfx[n-1]+depth];
+      uint8_t v = a < b ? (b < c ? b : (a < c ? c : a)) :
+                          (a < c ? a : (b < c ? c : b));
+
+      // Three-way partition.
+      size_t lt = 0, i = 0, gt = n;
+      while (i < gt) {
+         uint8_t x = txt[sfx[i]+depth];
+         int64_t tmp = sfx[i];
+         if (x < v) {
+            sfx[i++] = sfx[lt];
+            sfx[lt++] = tmp;
+         }
+         else if (x > v) {
+            sfx[i] = sfx[--gt];
+            sfx[gt] = tmp;
+         }
+         else {
+            i++;
+         }
+      }
+
+      sort_suffixes(dc, sfx, tie, lt, depth);
+      sort_suffixes(dc, sfx + gt, tie ? tie + gt : NULL, n - gt, depth);
+
+      // Only one suffix can reach the terminator.
+      if (v == 0) return;
+
+      sfx += lt;
+      tie = tie ? tie + lt : NULL;
+      n = gt - lt;
+      depth++;
+
+      // In repeats, the middle part shares many more characters.
+      // Skip them instead of partitioning on each of them.
+      if (n > 1 && depth < dc->v) {
+         const size_t max = dc->v - depth < SKIP ? dc->v - depth : SKIP;
+         depth += common_prefix(dc, sfx, n, depth, max);
       }
+
    }
 
-   return bwt;
+}
+
+
+// Buckets taken at once by the threads of 'sort_buckets()'.
+#define SORTGRP 64
+
+// Arguments of the threads of 'compute_sa_mt()' and 'rank_dcover()'.
+struct sa_job_t {
+   const char     * txt;
+   size_t           txtlen;
+   size_t           from;      // Chunk of the text.
+   size_t           to;
+   size_t         * count;     // Suffixes of the chunk per bucket.
+   int64_t        * sa;        // Suffixes grouped by bucket.
+   uint8_t        * tie;       // Ties (if the cover is not ranked).
+   const dcover_t * dc;
+   const size_t   * start;     // First suffix of each bucket.
+   size_t         * next;      // Next bucket to sort (shared).
+};
 
+
+size_t
+bucket_key
+(
+   const char   * txt,
+   const size_t   txtlen,
+   const size_t   pos
+)
+// Bucket of the suffix at 'pos' (see 'count_buckets()').
+{
+   size_t key = 0;
+   for (size_t j = SORTK ; j-- > 0 ; ) {
+      const uint8_t c = pos + j < txtlen ? txt[pos+j] : 0;
+      key = key / 5 + CODE5[c] * (NBUCKETS / 5);
+   }
+   return key;
 }
 
 
-void
-write_occ_blocks
+void *
+count_chunk
 (
-   occ_t    * occ,
-   uint32_t * smpl,
-   uint32_t * bits,
-   size_t     idx    // Index of 'blocc_t' in array.
+   void * arg
 )
-// Write 'SIGMA' smpl/bits blocks to the 'blocc_t' arrays of 'Occ'
-// at position 'pos' (the array index and not the position in
-// the BWT).
+// Count the suffixes of the chunk in each bucket, as in
+// 'count_buckets()'. The key is rolled from 'SORTK' characters
+// after the chunk.
 {
-   for (int i = 0 ; i < SIGMA ; i++) {
-      occ->rows[i * occ->nrows + idx].smpl = smpl[i];
-      occ->rows[i * occ->nrows + idx].bits = bits[i];
+   struct sa_job_t * job = arg;
+   const char * txt = job->txt;
+   const size_t end = job->to + SORTK < job->txtlen ?
+      job->to + SORTK : job->txtlen;
+   size_t key = 0;
+   for (size_t i = end ; i-- > job->from ; ) {
+      uint8_t c = txt[i];
+      exit_if(c != 0 && CODE5[c] == 0);
+      key = key / 5 + CODE5[c] * (NBUCKETS / 5);
+      if (i < job->to) job->count[key]++;
    }
+   return NULL;
 }
 
 
-occ_t *
-create_occ
+void *
+scatter_chunk
 (
-   bwt_t * bwt
+   void * arg
 )
+// Write the suffixes of the chunk to their bucket in the suffix
+// array. 'count' holds the next row of each bucket for the chunk.
 {
+   struct sa_job_t * job = arg;
+   const char * txt = job->txt;
+   const size_t end = job->to + SORTK < job->txtlen ?
+      job->to + SORTK : job->txtlen;
+   size_t key = 0;
+   for (size_t i = end ; i-- > job->from ; ) {
+      key = key / 5 + CODE5[(uint8_t) txt[i]] * (NBUCKETS / 5);
+      if (i < job->to) job->sa[job->count[key]++] = i;
+   }
+   return NULL;
+}
 
-   // Allocate new 'Occ_t'.
-   const size_t txtlen = bwt->txtlen;
-   const size_t nrows = (txtlen + (32-1)) / 32;
-   const size_t extra = SIGMA * nrows * sizeof(blocc_t);
 
-   occ_t * occ = malloc(sizeof(occ_t) + extra);
-   exit_on_memory_error(occ);
+void *
+sort_buckets
+(
+   void * arg
+)
+// Sort the buckets of 'sa' by groups of 'SORTGRP' until none is
+// left. The groups are taken in turn by the threads, so that they
+// finish together even if the buckets are uneven.
+{
+   struct sa_job_t * job = arg;
+   size_t b0;
+   while ((b0 = __atomic_fetch_add(job->next, SORTGRP,
+               __ATOMIC_RELAXED)) < NBUCKETS) {
+      const size_t b1 = b0 + SORTGRP < NBUCKETS ? b0 + SORTGRP : NBUCKETS;
+      for (size_t b = b0 ; b < b1 ; b++) {
+         const size_t from = job->start[b];
+         const size_t n = job->start[b+1] - from;
+         if (n > 1) sort_suffixes(job->dc, job->sa + from,
+               job->tie ? job->tie + from : NULL, n, SORTK);
+      }
+   }
+   return NULL;
+}
+
 
-   occ->txtlen = txtlen;
-   occ->nrows = nrows;
+static int
+compare_rows
+(
+   const void * a,
+   const void * b
+)
+{
+   const uint64_t x = *(const uint64_t *) a;
+   const uint64_t y = *(const uint64_t *) b;
+   return (x > y) - (x < y);
+}
 
-   uint32_t smpl[SIGMA] = {0};
-   uint32_t diff[SIGMA] = {0};
-   uint32_t bits[SIGMA] = {0};
 
-   for (size_t pos = 0 ; pos < bwt->txtlen ; pos++) {
-      // Extract symbol at position 'i' from BWT.
-      uint8_t c = bwt->slots[pos/4] >> 2*(pos % 4) & 0b11;
-      if (pos != bwt->zero) {   // (Skip the '$' symbol).
-         diff[c]++;
-         bits[c] |= (1 << (31 - pos % 32));
-      }
-      if (pos % 32 == 31) {     // Write every 32 entries.
-         write_occ_blocks(occ, smpl, bits, pos/32);
-         memcpy(smpl, diff, SIGMA * sizeof(uint32_t));
-         bzero(bits, sizeof(bits));
-      }
+dcover_t *
+rank_dcover
+(
+   const char   * txt,
+   const size_t   m,
+         int      nthreads
+)
+// Rank the suffixes of the difference cover of period 'm^2', where
+// 'm' is a power of 2. They are sorted by their first 'v' characters
+// on 'nthreads' threads (grouped by bucket as in 'compute_sa_mt()'),
+// then the ties, which come from repeats longer than 'v', are broken
+// by prefix doubling.
+{
+
+   dcover_t * dc = calloc(1, sizeof(dcover_t));
+   exit_on_memory_error(dc);
+
+   dc->txt = txt;
+   dc->txtlen = strlen(txt) + 1;
+   exit_if(m < 2 || (m & (m-1)) != 0);
+
+   dc->m = m;
+   dc->lgm = __builtin_ctzl(m);
+   dc->v = m*m;
+   dc->nd = 2*m - 1;
+
+   // Offsets of the residue classes in reduced order.
+   dc->off = malloc((dc->nd + 1) * sizeof(size_t));
+   exit_on_memory_error(dc->off);
+
+   dc->off[0] = 0;
+   for (size_t idx = 0 ; idx < dc->nd ; idx++) {
+      size_t r = dc_residue(dc, idx);
+      size_t len = r < dc->txtlen ? (dc->txtlen - r + dc->v - 1) / dc->v : 0;
+      dc->off[idx+1] = dc->off[idx] + len;
    }
 
-   write_occ_blocks(occ, smpl, bits, (bwt->txtlen-1)/32);
+   const size_t ns = dc->off[dc->nd];
+   exit_if(ns >= UINT32_MAX);
+
+   // Sort the sampled suffixes by their first 'v' characters.
+   int64_t * sfx = malloc(ns * sizeof(int64_t));
+   exit_on_memory_error(sfx);
+   uint8_t * tie = calloc(ns, sizeof(uint8_t));
+   exit_on_memory_error(tie);
+
+   size_t *start = calloc(NBUCKETS+1, sizeof(size_t));
+   exit_on_memory_error(start);
+   for (size_t idx = 0 ; idx < dc->nd ; idx++) {
+      size_t r = dc_residue(dc, idx);
+      for (size_t q = 0 ; q < dc->off[idx+1] - dc->off[idx] ; q++)
+         start[bucket_key(txt, dc->txtlen, q * dc->v + r) + 1]++;
+   }
+   for (size_t b = 0 ; b < NBUCKETS ; b++) start[b+1] += start[b];
+   for (size_t idx = 0 ; idx < dc->nd ; idx++) {
+      size_t r = dc_residue(dc, idx);
+      for (size_t q = 0 ; q < dc->off[idx+1] - dc->off[idx] ; q++) {
+         const size_t pos = q * dc->v + r;
+         sfx[start[bucket_key(txt, dc->txtlen, pos)]++] = pos;
+      }
+   }
+   // The cursors are now the starts of the next buckets.
+   memmove(start + 1, start, NBUCKETS * sizeof(size_t));
+   start[0] = 0;
+
+   // The first suffix of a bucket is never tied with the previous.
+   if (nthreads < 1) nthreads = 1;
+   size_t next = 0;
+   struct sa_job_t job = { .sa = sfx, .tie = tie, .dc = dc,
+      .start = start, .next = &next };
+   struct sa_job_t jobs[nthreads];
+   for (int t = 0 ; t < nthreads ; t++) jobs[t] = job;
+   run_threads(sort_buckets, jobs, sizeof(*jobs), nthreads);
+   free(start);
+
+   // Initial ranks: the row of the first suffix of the group.
+   dc->rank = malloc(ns * sizeof(uint32_t));
+   exit_on_memory_error(dc->rank);
+
+   size_t maxgrp = 1;
+   for (size_t i = 0, first = 0 ; i < ns ; i++) {
+      if (!tie[i]) first = i;
+      if (i + 1 - first > maxgrp) maxgrp = i + 1 - first;
+      dc->rank[dc_at(dc, sfx[i])] = first;
+   }
 
-   // Write 'C'.
-   occ->C[0] = 1;
-   for (int i = 1 ; i < SIGMA+1 ; i++) {
-      occ->C[i] = occ->C[i-1] + diff[i-1];
+   // Prefix doubling (Larsson & Sadakane). Two suffixes tied on 'h'
+   // characters are at least 'h+1' long, so the sampled suffixes 'h'
+   // characters further exist, and sorting them by their ranks breaks
+   // the ties on '2h' characters. The ranks are updated in place,
+   // which only refines them. Every ranked suffix is its own group
+   // when there are no ties left.
+   uint64_t * key = malloc(maxgrp * sizeof(uint64_t));
+   exit_on_memory_error(key);
+   int64_t * grp = malloc(maxgrp * sizeof(int64_t));
+   exit_on_memory_error(grp);
+
+   for (size_t h = dc->v ; maxgrp > 1 ; h *= 2) {
+      maxgrp = 1;
+      for (size_t i = 0, j ; i < ns ; i = j) {
+         for (j = i + 1 ; j < ns && tie[j] ; j++);
+         if (j - i < 2) continue;
+         // Keys are the ranks in the high bits, the index in the low.
+         for (size_t k = i ; k < j ; k++) {
+            const uint64_t r = dc->rank[dc_at(dc, sfx[k] + h)];
+            key[k-i] = (r << 32) | (k-i);
+            grp[k-i] = sfx[k];
+         }
+         qsort(key, j-i, sizeof(uint64_t), compare_rows);
+         size_t first = i;
+         for (size_t k = i ; k < j ; k++) {
+            sfx[k] = grp[key[k-i] & 0xFFFFFFFF];
+            tie[k] = k > i && (key[k-i] >> 32) == (key[k-i-1] >> 32);
+            if (!tie[k]) first = k;
+            if (k + 1 - first > maxgrp) maxgrp = k + 1 - first;
+            dc->rank[dc_at(dc, sfx[k])] = first;
+         }
+      }
    }
 
-   return occ;
+   free(grp);
+   free(key);
+   free(tie);
+   free(sfx);
+
+   return dc;
 
 }
 
 
-size_t
-get_rank
+void
+free_dcover
 (
-   const occ_t   * occ,
-         uint8_t   c,
-         size_t    pos
+   dcover_t * dc
 )
 {
-   uint32_t smpl = occ->rows[c*occ->nrows + pos/32].smpl;
-   uint32_t bits = occ->rows[c*occ->nrows + pos/32].bits;
-   // Several options for pop-count have been tested for this
-   // implementation. In the end, I chose '__builtin_popcountl' because
-   // the performance is good and the code is simple.
-   return occ->C[c] + smpl + __builtin_popcountl(bits >> (31 - pos % 32));
+   free(dc->off);
+   free(dc->rank);
+   free(dc);
 }
 
 
-void
-fill_lut
+size_t *
+count_buckets
 (
-         lut_t   * lut,
-   const occ_t   * occ,
-   const range_t   range,
-   const size_t    depth,
-   const size_t    kmerid
+   const char * txt
 )
+// Return the number of suffixes of 'txt' in each bucket.
+// The text must contain only the symbols of 'ALPHABET'.
 {
-   if (depth >= LUTK) {
-      lut->kmer[kmerid] = range;
-      return;
-   }
-   for (uint8_t c = 0 ; c < SIGMA ; c++) {
-      size_t bot = get_rank(occ, c, range.bot - 1);
-      size_t top = get_rank(occ, c, range.top) - 1;
-      fill_lut(lut, occ, (range_t) { .bot=bot, .top=top },
-            depth+1, c + (kmerid << 2));
+
+   const size_t txtlen = strlen(txt) + 1;
+   size_t *count = calloc(NBUCKETS, sizeof(size_t));
+   exit_on_memory_error(count);
+
+   // Scan backward and roll the key of the suffixes.
+   size_t key = 0;
+   for (size_t i = txtlen ; i-- > 0 ; ) {
+      uint8_t c = txt[i];
+      exit_if(c != 0 && CODE5[c] == 0);
+      key = key / 5 + CODE5[c] * (NBUCKETS / 5);
+      count[key]++;
    }
-}
 
+   return count;
+
+}
 
-// SECTION 4.2 QUERY FUNCTIONS //
 
-range_t
-backward_search
+int64_t *
+compute_sa_mt
 (
-   const char   * query,
-   const size_t   len,
-   const occ_t  * occ
+   const char * txt,
+   const int    nthreads
 )
-// Used to search a substring using 'occ' and 'C'.
-// In case the query is not found, the condition
-// 'range.top - range.bot == -1' is true.
+// Same as 'compute_sa()' on 'nthreads' threads. With one thread, the
+// suffixes are sorted by 'divsufsort()'. Otherwise, they are split by
+// their first 'SORTK' characters as in 'sort_blocks()': the threads
+// count the buckets of their chunk of the text, write the suffixes
+// to their bucket and sort the buckets independently. The text must
+// then contain only the symbols of 'ALPHABET'. The output does not
+// depend on the number of threads.
 {
 
-   range_t range = { .bot = 1, .top = occ->txtlen-1 };
-   int offset = 0;
+   const size_t txtlen = strlen(txt) + 1;
+   int64_t *sa = malloc(txtlen * sizeof(int64_t));
+   exit_on_memory_error(sa);
 
-   for ( ; offset < len ; offset++) {
-      int c = ENCODE[(uint8_t) query[len-offset-1]];
-      range.bot = get_rank(occ, c, range.bot - 1);
-      range.top = get_rank(occ, c, range.top) - 1;
-      if (range.top < range.bot)
-         return range;
+   if (nthreads <= 1) {
+      divsufsort((const unsigned char *) txt, sa, txtlen);
+      return sa;
    }
 
-   return range;
+   struct sa_job_t job[nthreads];
+   for (int t = 0 ; t < nthreads ; t++) {
+      job[t] = (struct sa_job_t) { .txt = txt, .txtlen = txtlen,
+         .from = txtlen * t / nthreads, .to = txtlen * (t+1) / nthreads,
+         .sa = sa };
+      job[t].count = calloc(NBUCKETS, sizeof(size_t));
+      exit_on_memory_error(job[t].count);
+   }
+
+   run_threads(count_chunk, job, sizeof(*job), nthreads);
+
+   // The suffixes of a bucket are written chunk after chunk.
+   size_t *start = malloc((NBUCKETS+1) * sizeof(size_t));
+   exit_on_memory_error(start);
+   size_t row = 0;
+   for (size_t b = 0 ; b < NBUCKETS ; b++) {
+      start[b] = row;
+      for (int t = 0 ; t < nthreads ; t++) {
+         const size_t n = job[t].count[b];
+         job[t].count[b] = row;
+         row += n;
+      }
+   }
+   start[NBUCKETS] = row;
+
+   run_threads(scatter_chunk, job, sizeof(*job), nthreads);
+
+   // The ranks of the cover break the ties of the repeats longer
+   // than its period (1024), there are about 'txtlen / 16' of them.
+   // The suffixes of such repeats are compared up to the period,
+   // which should stay short.
+   dcover_t *dc = rank_dcover(txt, 32, nthreads);
+
+   size_t next = 0;
+   for (int t = 0 ; t < nthreads ; t++) {
+      free(job[t].count);
+      job[t].dc = dc;
+      job[t].start = start;
+      job[t].next = &next;
+   }
+
+   run_threads(sort_buckets, job, sizeof(*job), nthreads);
+
+   free(start);
+   free_dcover(dc);
+
+   return sa;
 
 }
 
 
+// Smallest block of 'sort_blocks()' in suffixes, whatever the budget.
+#define MINBLK 4096
+
+// State of 'sort_blocks()'.
+typedef struct blocks_t blocks_t;
+
+struct blocks_t {
+   const char     * txt;
+   size_t           txtlen;
+   const dcover_t * dc;
+   int64_t        * blk;      // Block of 'maxblk' suffixes.
+   size_t           maxblk;
+   size_t           r0;       // First row of the next block.
+   void          (* emit)(const int64_t *, size_t, size_t, void *);
+   void           * data;
+};
+
+
 size_t
-query_csa
+count_below
 (
-   csa_t  * csa,
-   bwt_t  * BWT,
-   occ_t  * occ,
-   size_t   pos
+   const dcover_t * dc,
+   const int64_t  * spl,
+   const size_t     nspl,
+   const size_t     pos
 )
+// Number of suffixes in the sorted array 'spl' that are not greater
+// than the suffix at 'pos', all of them in the same bucket.
 {
-
-   if (pos == BWT->zero) return 0;
-   if (pos % 16 == 0) {
-      // Value is sampled. Extract it.
-      size_t idx = pos / 16;
-      size_t lo  = csa->nbits * idx;
-      size_t hi  = csa->nbits * (idx+1)-1;
-      if (lo/64 == hi/64) {
-         // Entry fits in a single 'uint64_t'.
-         // Use mask to extract the n-bit encoding of the position.
-         return (size_t) csa->bitf[lo/64] >> lo % 64 & csa->bmask;
-      }
-      else {
-         // Entry is split between two 'uint64_t'.
-         size_t lo_bits = (size_t) csa->bitf[lo/64] >> lo % 64;
-         size_t hi_bits = (size_t) csa->bitf[hi/64] << (64-lo) % 64;
-         return (lo_bits | hi_bits) & csa->bmask;
-      }
+   size_t lo = 0, hi = nspl;
+   while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (compare_suffixes(dc, spl[mid], pos, SORTK) <= 0) lo = mid + 1;
+      else hi = mid;
    }
-   uint8_t c = BWT->slots[pos/4] >> 2*(pos % 4) & 0b11;
-   size_t nextpos = get_rank(occ, c, pos) - 1;
-   return query_csa(csa, BWT, occ, nextpos) + 1;
+   return lo;
+}
+
 
+int
+in_split
+(
+   const dcover_t * dc,
+   const int64_t    lo,
+   const int64_t    hi,
+   const size_t     pos
+)
+// Return 1 if the suffix at 'pos' is in '[lo, hi)', where the bounds
+// are suffixes of the same bucket (or -1 if there is no bound).
+{
+   return (lo < 0 || compare_suffixes(dc, lo, pos, SORTK) <= 0) &&
+      (hi < 0 || compare_suffixes(dc, pos, hi, SORTK) < 0);
 }
 
-   // Look up the beginning (in reverse)
-   // of the query in an array of k-mers.
-   /*
-   if (len >= HSTUB) {
-      size_t merid = 0;
-      for ( ; offset < HSTUB ; offset++) {
-         merid = (merid << 2) + ENCODE[(uint8_t) query[len-offset-1]];
-      }
-      fprintf(stderr, "merid: %ld\n", merid);
-      range = occ->stub[merid];
-      if (range.top < range.bot)
-         return range;
-   }
-   */
+
+void
+split_bucket
+(
+         blocks_t * bs,
+   const size_t     bkt,
+   const int64_t    lo,
+   const int64_t    hi,
+   const size_t     n
+)
+// Sort and emit the 'n' suffixes of bucket 'bkt' in '[lo, hi)', that
+// do not fit in a block. They are split by the suffixes of a sorted
+// sample, compared with the difference cover, so repeats do not make
+// the split longer (unlike longer prefixes, that a run of 'A' never
+// separates). The parts are grouped in blocks like the buckets, and
+// a part that is still too large is split again.
+{
+
+   const char * txt = bs->txt;
+   int64_t * blk = bs->blk;
+
+   // Sample the suffixes evenly and sort them.
+   const size_t step = n / bs->maxblk + 1;
+   size_t nsmpl = 0;
+   size_t key = 0;
+   for (size_t i = bs->txtlen, t = 0 ; i-- > 0 ; ) {
+      key = key / 5 + CODE5[(uint8_t) txt[i]] * (NBUCKETS / 5);
+      if (key != bkt || !in_split(bs->dc, lo, hi, i)) continue;
+      if (t++ % step == 0 && nsmpl < bs->maxblk) blk[nsmpl++] = i;
+   }
+   sort_suffixes(bs->dc, blk, NULL, nsmpl, SORTK);
+
+   // Parts of about half a block.
+   size_t nparts = 2 * n / bs->maxblk + 2;
+   if (nparts > nsmpl / 8) nparts = nsmpl / 8;
+   if (nparts < 2) nparts = 2;
+   int64_t *spl = malloc((nparts - 1) * sizeof(int64_t));
+   exit_on_memory_error(spl);
+   for (size_t j = 1 ; j < nparts ; j++)
+      spl[j-1] = blk[j * nsmpl / nparts];
+
+   size_t *count = calloc(nparts, sizeof(size_t));
+   exit_on_memory_error(count);
+   size_t *cursor = malloc(nparts * sizeof(size_t));
+   exit_on_memory_error(cursor);
+
+   key = 0;
+   for (size_t i = bs->txtlen ; i-- > 0 ; ) {
+      key = key / 5 + CODE5[(uint8_t) txt[i]] * (NBUCKETS / 5);
+      if (key != bkt || !in_split(bs->dc, lo, hi, i)) continue;
+      count[count_below(bs->dc, spl, nparts - 1, i)]++;
+   }
+
+   size_t p0 = 0;
+   while (p0 < nparts) {
+
+      if (count[p0] > bs->maxblk) {
+         split_bucket(bs, bkt, p0 ? spl[p0-1] : lo,
+               p0 < nparts - 1 ? spl[p0] : hi, count[p0]);
+         p0++;
+         continue;
+      }
+
+      // Same as the buckets in 'sort_blocks()'.
+      size_t p1 = p0;
+      size_t nsfx = 0;
+      do {
+         cursor[p1] = nsfx;
+         nsfx += count[p1++];
+      } while (p1 < nparts && nsfx + count[p1] <= bs->maxblk);
+
+      key = 0;
+      for (size_t i = bs->txtlen ; i-- > 0 ; ) {
+         key = key / 5 + CODE5[(uint8_t) txt[i]] * (NBUCKETS / 5);
+         if (key != bkt || !in_split(bs->dc, lo, hi, i)) continue;
+         size_t p = count_below(bs->dc, spl, nparts - 1, i);
+         if (p >= p0 && p < p1) blk[cursor[p]++] = i;
+      }
+
+      for (size_t p = p0, start = 0 ; p < p1 ; start += count[p++]) {
+         if (count[p] > 1)
+            sort_suffixes(bs->dc, blk + start, NULL, count[p], SORTK);
+      }
+
+      if (nsfx > 0) bs->emit(blk, nsfx, bs->r0, bs->data);
+      bs->r0 += nsfx;
+      p0 = p1;
+
+   }
+
+   free(cursor);
+   free(count);
+   free(spl);
+
+}
+
+
+void
+sort_blocks
+(
+   const char   * txt,
+   const size_t   budget,
+   void        (* emit)(const int64_t *, size_t, size_t, void *),
+   void         * data
+)
+// Sort the suffixes of 'txt' by blocks of about 'budget' bytes.
+// The suffixes are bucketed by their first 'SORTK' characters and
+// a block is a run of consecutive buckets, so the blocks come out
+// in order. The buckets larger than a block are split further (see
+// 'split_bucket()'). Every sorted block is passed to 'emit()'
+// together with its size, its first row in the suffix array and
+// 'data'.
+{
+
+   const size_t txtlen = strlen(txt) + 1;
+
+   size_t *count = count_buckets(txt);
+
+   // Ranking the cover takes at most 32 bytes per sampled suffix
+   // and there are about '2 * txtlen / m' of them. Use the smallest
+   // period that fits in the budget.
+   size_t m = 32;
+   while (m < 1024 && 64 * (txtlen / m) > budget) m *= 2;
+   dcover_t *dc = rank_dcover(txt, m, 1);
+
+   // The blocks never exceed the budget (above 'MINBLK').
+   size_t maxblk = budget / sizeof(int64_t);
+   if (maxblk < MINBLK) maxblk = MINBLK;
+
+   int64_t *blk = malloc(maxblk * sizeof(int64_t));
+   exit_on_memory_error(blk);
+   size_t *cursor = malloc(NBUCKETS * sizeof(size_t));
+   exit_on_memory_error(cursor);
+
+   blocks_t bs = { .txt = txt, .txtlen = txtlen, .dc = dc, .blk = blk,
+      .maxblk = maxblk, .r0 = 0, .emit = emit, .data = data };
+
+   size_t b0 = 0;    // First bucket of the block.
+
+   while (b0 < NBUCKETS) {
+
+      if (count[b0] > maxblk) {
+         split_bucket(&bs, b0, -1, -1, count[b0]);
+         b0++;
+         continue;
+      }
+
+      // Add buckets to the block until the budget is exhausted.
+      size_t b1 = b0;
+      size_t nsfx = 0;
+      do {
+         cursor[b1] = nsfx;
+         nsfx += count[b1++];
+      } while (b1 < NBUCKETS && nsfx + count[b1] <= maxblk);
+
+      // Collect the suffixes of the block, grouped by bucket.
+      size_t key = 0;
+      for (size_t i = txtlen ; i-- > 0 ; ) {
+         key = key / 5 + CODE5[(uint8_t) txt[i]] * (NBUCKETS / 5);
+         if (key >= b0 && key < b1) blk[cursor[key]++] = i;
+      }
+
+      // Sort the buckets (they share their first 'SORTK' characters).
+      for (size_t b = b0, start = 0 ; b < b1 ; start += count[b++]) {
+         if (count[b] > 1)
+            sort_suffixes(dc, blk + start, NULL, count[b], SORTK);
+      }
+
+      if (nsfx > 0) emit(blk, nsfx, bs.r0, data);
+
+      bs.r0 += nsfx;
+      b0 = b1;
+
+   }
+
+   exit_if(bs.r0 != txtlen);
+
+   free(cursor);
+   free(blk);
+   free(count);
+   free_dcover(dc);
+
+}
+
+
+void
+write_sa_block
+(
+   const int64_t * blk,
+   const size_t    n,
+   const size_t    from,
+         void    * data
+)
+// Write a block of the suffix array to its place in
+// the file with descriptor '*(int *) data'.
+{
+   const int fd = *(int *) data;
+   const char *bytes = (const char *) blk;
+   size_t sz = n * sizeof(int64_t);
+   size_t ws = 0;
+   while (ws < sz) {
+      ssize_t w = pwrite(fd, bytes + ws, sz - ws,
+            from * sizeof(int64_t) + ws);
+      exit_if(w < 0);
+      ws += w;
+   }
+}
+
+
+int64_t *
+compute_sa_ext
+(
+   const char * txt,
+   const size_t budget,
+   const char * tmpdir
+)
+// Same as 'compute_sa()', using about 'budget' bytes of memory for
+// the suffix array. The blocks of 'sort_blocks()' are written to
+// their place in a scratch file of 'tmpdir'. The file is mapped
+// back in memory and unlinked, so it is deleted when the mapping
+// is released with 'munmap(sa, (sa[0]+1) * sizeof(int64_t))'.
+{
+
+   const size_t txtlen = strlen(txt) + 1;
+   const size_t sasz = txtlen * sizeof(int64_t);
+
+   // Create the scratch file.
+   char path[256];
+   exit_if(strlen(tmpdir) > 240);
+   sprintf(path, "%s/sa.XXXXXX", tmpdir);
+   int fd = mkstemp(path);
+   if (fd < 0) exit_cannot_open(path);
+   unlink(path);
+   exit_if(ftruncate(fd, sasz) != 0);
+
+   sort_blocks(txt, budget, write_sa_block, &fd);
+
+   int64_t *sa = mmap(NULL, sasz, PROT_READ, MAP_SHARED, fd, 0);
+   exit_if(sa == MAP_FAILED);
+   close(fd);
+
+   // The suffix array is consumed sequentially.
+   madvise(sa, sasz, MADV_SEQUENTIAL);
+
+   return sa;
+
+}
+
+
+csa_t *
+alloc_csa
+(
+   const size_t txtlen
+)
+// Allocate an empty compressed suffix array for a text of
+// length 'txtlen' (including the terminator).
+{
+
+   // Compute the number of required bits.
+   size_t nbits = 0;
+   while (txtlen > ((uint64_t) 1 << nbits)) nbits++;
+
+   // Compute the number of required bytes and 'uint64_t'.
+   size_t nnumb = (txtlen + (16-1)) / 16;
+   size_t nint64 = (nbits * nnumb + (64-1)) / 64;
+   csa_t * csa = calloc(1, sizeof(csa_t) + nint64 * 8);
+   exit_on_memory_error(csa);
+
+   csa->nbits = nbits;
+   csa->nint64 = nint64;
+
+   // Set a mask for the 'nbits' lower bits.
+   csa->bmask = ((uint64_t) 0xFFFFFFFFFFFFFFFF) >> (64-nbits);
+
+   return csa;
+
+}
+
+
+void
+fill_csa
+(
+         csa_t   * csa,
+   const int64_t * sa,
+   const size_t    from,
+   const size_t    n
+)
+// Sample the 'n' entries of the suffix array that start at row
+// 'from' and are passed in 'sa' (i.e. 'sa[0]' is row 'from').
+{
+   // Sample every 16-th value.
+   for (size_t pos = (from + (16-1)) / 16 * 16 ; pos < from + n ; pos += 16) {
+      uint64_t current = sa[pos - from];
+      size_t lo = csa->nbits * (pos / 16);
+      // Store the compact representation.
+      csa->bitf[lo/64] |= current << lo % 64;
+      // Complete in the next word if the entry is split.
+      if (lo % 64 + csa->nbits > 64) {
+         csa->bitf[lo/64 + 1] |= current >> (64 - lo % 64);
+      }
+   }
+}
+
+
+csa_t *
+compress_sa
+(
+   int64_t * sa
+)
+{
+
+   // The first entry of the suffix array is the length of the text.
+   size_t txtlen = sa[0] + 1;
+
+   csa_t * csa = alloc_csa(txtlen);
+   fill_csa(csa, sa, 0, txtlen);
+
+   return csa;
+
+}
+
+
+bwt_t *
+alloc_bwt
+(
+   const size_t txtlen
+)
+// Allocate an empty BWT for a text of length 'txtlen'
+// (including the terminator).
+{
+
+   const size_t nslots = (txtlen + (4-1)) / 4;
+   const size_t extra = nslots * sizeof(uint8_t);
+
+   bwt_t *bwt = calloc(1, sizeof(bwt_t) + extra);
+   exit_on_memory_error(bwt);
+
+   bwt->txtlen = txtlen;
+   bwt->nslots = nslots;
+
+   return bwt;
+
+}
+
+
+void
+fill_bwt
+(
+         bwt_t   * bwt,
+   const char    * txt,
+   const int64_t * sa,
+   const size_t    from,
+   const size_t    n
+)
+// Write the BWT at the 'n' rows that start at 'from', using
+// the entries of the suffix array passed in 'sa'.
+{
+   // Encode characters with 2 bits.
+   for (size_t pos = from ; pos < from + n ; pos++) {
+      if (sa[pos - from] > 0) {
+         uint8_t c = ENCODE[(uint8_t) txt[sa[pos - from]-1]];
+         bwt->slots[pos/4] |= c << 2*(pos % 4);
+      }
+      else {
+         // Record the position of the zero.
+         bwt->zero = pos;
+      }
+   }
+}
+
+
+bwt_t *
+create_bwt
+(
+   const char    * txt,
+   const int64_t * sa
+)
+{
+
+   const size_t txtlen = strlen(txt) + 1;           // Do not forget $.
+
+   bwt_t *bwt = alloc_bwt(txtlen);
+   fill_bwt(bwt, txt, sa, 0, txtlen);
+
+   return bwt;
+
+}
+
+
+static inline const blocc_t *
+occ_entry
+(
+   const occ_t   * occ,
+   const int       c,
+   const size_t    row
+)
+// Return the 'blocc_t' of symbol 'c' for 'row' (i.e. 'pos/32').
+{
+   return occ->layout == OCC_INTERLEAVED ?
+      occ->rows + row*SIGMA + c : occ->rows + c*occ->nrows + row;
+}
+
+
+static inline const void *
+occ_addr
+(
+   const occ_t   * occ,
+   const int       c,
+   const size_t    pos
+)
+// Return the address of the entry (or of the line) of symbol 'c'
+// for 'pos', in any layout.
+{
+   if (occ->layout == OCC_PACKED)
+      return (const line_t *) occ->rows + pos / 192;
+   return occ_entry(occ, c, pos / 32);
+}
+
+
+static inline int
+same_entry
+(
+   const occ_t   * occ,
+   const size_t    a,
+   const size_t    b
+)
+// Return 1 if the ranks at 'a' and 'b' are read from the
+// same entry (or line), 0 otherwise.
+{
+   // Constant divisors, a division by a variable is much slower.
+   if (occ->layout == OCC_PACKED)
+      return a / 192 == b / 192;
+   return a / 32 == b / 32;
+}
+
+
+static inline uint64_t *
+occ_super
+(
+   const occ_t   * occ
+)
+// Return the superblock counts, stored after the entries.
+{
+   return occ->layout == OCC_PACKED ?
+      (uint64_t *) ((const line_t *) occ->rows + occ->nrows) :
+      (uint64_t *) (occ->rows + SIGMA * occ->nrows);
+}
+
+
+size_t
+occ_size
+(
+   const occ_t   * occ
+)
+// Size of the Occ table in bytes.
+{
+   if (occ->layout == OCC_PACKED) {
+      const size_t nsuper = ((occ->nrows-1) >> OCC_LINE_SHIFT) + 1;
+      return sizeof(occ_t) + occ->nrows * sizeof(line_t) +
+         SIGMA * nsuper * sizeof(uint64_t);
+   }
+   const size_t nsuper = ((occ->txtlen-1) >> OCC_SUPER_SHIFT) + 1;
+   return sizeof(occ_t) + SIGMA * occ->nrows * sizeof(blocc_t) +
+      SIGMA * nsuper * sizeof(uint64_t);
+}
+
+
+void
+write_occ_blocks
+(
+   occ_t    * occ,
+   uint32_t * smpl,
+   uint32_t * bits,
+   size_t     idx    // Index of 'blocc_t' in array.
+)
+// Write 'SIGMA' smpl/bits blocks to the 'blocc_t' arrays of 'Occ'
+// at position 'pos' (the array index and not the position in
+// the BWT).
+{
+   for (int i = 0 ; i < SIGMA ; i++) {
+      occ->rows[i * occ->nrows + idx].smpl = smpl[i];
+      occ->rows[i * occ->nrows + idx].bits = bits[i];
+   }
+}
+
+
+occ_t *
+alloc_occ
+(
+   const size_t txtlen
+)
+// Allocate an Occ table for a BWT of length 'txtlen'
+// (including the terminator).
+{
+
+   occ_t header = { .txtlen = txtlen, .nrows = (txtlen + (32-1)) / 32,
+      .layout = OCC_SPLIT };
+
+   occ_t * occ = malloc(occ_size(&header));
+   exit_on_memory_error(occ);
+
+   *occ = header;
+
+   return occ;
+
+}
+
+
+void
+finish_occ
+(
+   occ_t * occ
+)
+// Write the superblock counts, the 'C' array and the position of
+// '$' of an Occ table in the layout OCC_SPLIT or OCC_INTERLEAVED.
+// The samples of the entries are only the counts modulo 2^32, so
+// the true counts are obtained from the bitfields.
+{
+   uint64_t * super = occ_super(occ);
+   uint64_t total[SIGMA] = {0};
+   occ->zero = occ->txtlen;
+   for (size_t row = 0 ; row < occ->nrows ; row++) {
+      const size_t pos = row * 32;
+      if (pos % (1ULL << OCC_SUPER_SHIFT) == 0)
+         memcpy(super + (pos >> OCC_SUPER_SHIFT) * SIGMA, total,
+               sizeof(total));
+      uint32_t any = 0;
+      for (int i = 0 ; i < SIGMA ; i++) {
+         total[i] += __builtin_popcount(occ_entry(occ, i, row)->bits);
+         any |= occ_entry(occ, i, row)->bits;
+      }
+      // The '$' is the first position without a symbol.
+      if (~any && occ->zero == occ->txtlen)
+         occ->zero = pos + __builtin_clz(~any);
+   }
+   occ->C[0] = 1;
+   for (int i = 1 ; i < SIGMA+1 ; i++) {
+      occ->C[i] = occ->C[i-1] + total[i-1];
+   }
+}
+
+
+uint64_t
+gather_symbols
+(
+   uint64_t w,
+   int      c
+)
+// Return a word with bit '2i' set if and only if symbol 'i' of
+// the 32 symbols packed in 'w' is equal to 'c'.
+{
+   w ^= ~(0x5555555555555555ULL * c);
+   return w & (w >> 1) & 0x5555555555555555ULL;
+}
+
+
+uint64_t
+reverse_symbols
+(
+   uint64_t w
+)
+// Reverse the order of the 32 symbols packed in 'w', so that
+// symbol 0 goes to the most significant bits.
+{
+   w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+   w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+   return __builtin_bswap64(w);
+}
+
+
+void
+occ_word
+(
+   const uint64_t   w,
+   const uint32_t   mask,
+         uint32_t * bits,
+         uint32_t * pop
+)
+// Write in 'bits' the bitfields of the 'blocc_t' of the 32 symbols
+// packed in 'w' (the BWT slots of a block, in little endian), and
+// their popcounts in 'pop'. Only the positions set in 'mask' are
+// counted, to skip the '$' and the slots past the end of the BWT.
+{
+   const uint64_t r = reverse_symbols(w);
+   for (int c = 0 ; c < SIGMA ; c++) {
+      // Move the even bits to the lower half.
+      uint64_t x = gather_symbols(r, c);
+      x = (x | x >> 1) & 0x3333333333333333ULL;
+      x = (x | x >> 2) & 0x0F0F0F0F0F0F0F0FULL;
+      x = (x | x >> 4) & 0x00FF00FF00FF00FFULL;
+      x = (x | x >> 8) & 0x0000FFFF0000FFFFULL;
+      x = (x | x >> 16) & 0x00000000FFFFFFFFULL;
+      bits[c] = x & mask;
+      pop[c] = __builtin_popcount(bits[c]);
+   }
+}
+
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+__attribute__((target("bmi2,popcnt")))
+void
+occ_word_bmi2
+(
+   const uint64_t   w,
+   const uint32_t   mask,
+         uint32_t * bits,
+         uint32_t * pop
+)
+// Same as 'occ_word()' with the instructions 'pext' and 'popcnt'.
+{
+   const uint64_t r = reverse_symbols(w);
+   for (int c = 0 ; c < SIGMA ; c++) {
+      bits[c] = _pext_u64(gather_symbols(r, c), 0x5555555555555555ULL) & mask;
+      pop[c] = __builtin_popcount(bits[c]);
+   }
+}
+#endif
+
+
+void
+(*occ_word_kernel(void))
+(uint64_t, uint32_t, uint32_t *, uint32_t *)
+// Return the fastest version of 'occ_word()' for this CPU.
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+   if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt"))
+      return occ_word_bmi2;
+#endif
+   return occ_word;
+}
+
+
+// The rank and search kernels are compiled once per instruction set
+// from a generic body (see 'DISPATCH()'). The body is forced inline
+// in each variant, where '__builtin_popcountl()' becomes a 'popcnt'
+// instruction instead of a library call (there is no '-march').
+#define KERNEL static inline __attribute__((always_inline))
+
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__)
+// Define 'name' as the best variant of 'name_generic' for the CPU:
+// with 'popcnt' (SSE4.2), AVX2 or AVX-512 VPOPCNTDQ, which counts
+// the bits of several words at once. The variant is chosen once by
+// the loader (ifunc), so the CPU is not tested at each call. The
+// selector 'name_kernel()' plays the role of 'occ_word_kernel()'.
+#define DISPATCH(type, name, params, call)                             \
+   __attribute__((target("sse4.2,popcnt"))) static type                \
+   name##_popcnt params { call; }                                      \
+   __attribute__((target("avx2,popcnt"))) static type                  \
+   name##_avx2 params { call; }                                        \
+   __attribute__((target("avx512vpopcntdq,avx512vl"))) static type     \
+   name##_avx512 params { call; }                                      \
+   static type (*name##_kernel(void)) params                           \
+   {                                                                   \
+      __builtin_cpu_init();                                            \
+      if (__builtin_cpu_supports("avx512vpopcntdq") &&                 \
+            __builtin_cpu_supports("avx512vl"))                        \
+         return name##_avx512;                                         \
+      if (__builtin_cpu_supports("avx2") &&                            \
+            __builtin_cpu_supports("popcnt"))                          \
+         return name##_avx2;                                           \
+      if (__builtin_cpu_supports("popcnt"))                            \
+         return name##_popcnt;                                         \
+      return name##_generic;                                           \
+   }                                                                   \
+   type name params __attribute__((ifunc(#name "_kernel")));
+#else
+#define DISPATCH(type, name, params, call)                             \
+   static type (*name##_kernel(void)) params                           \
+   {                                                                   \
+      return name##_generic;                                           \
+   }                                                                   \
+   type name params { call; }
+#endif
+
+
+void
+fill_occ
+(
+         occ_t    * occ,
+   const bwt_t    * bwt,
+   const size_t     from,
+   const size_t     to,
+         uint32_t * count
+)
+// Write the 'blocc_t' of the positions 'from' to 'to' of the BWT
+// ('from' is a multiple of 32), starting with the counts in 'count'.
+// On exit, 'count' holds the counts up to position 'to'.
+{
+   void (*kernel)(uint64_t, uint32_t, uint32_t *, uint32_t *) =
+      occ_word_kernel();
+   for (size_t row = from/32 ; row*32 < to ; row++) {
+      // Load the 32 symbols of the block (8 slots).
+      uint64_t w = 0;
+      const size_t nbytes = bwt->nslots - 8*row < 8 ? bwt->nslots - 8*row : 8;
+      memcpy(&w, bwt->slots + 8*row, nbytes);
+      w = le64toh(w);
+      // Mask the positions past 'to' and the '$' symbol.
+      uint32_t mask = 0xFFFFFFFF;
+      if (to - row*32 < 32) mask <<= 32 - (to - row*32);
+      if (bwt->zero / 32 == row) mask &= ~(1U << (31 - bwt->zero % 32));
+      uint32_t bits[SIGMA];
+      uint32_t pop[SIGMA];
+      kernel(w, mask, bits, pop);
+      write_occ_blocks(occ, count, bits, row);
+      for (int i = 0 ; i < SIGMA ; i++)
+         count[i] += pop[i];
+   }
+}
+
+
+// Work of a thread on a chunk of a BWT. The positions of the
+// chunk are counted from 0 and the counts of the previous chunks
+// ('base') are added to the 'blocc_t' in a second pass.
+struct chunk_t {
+   occ_t          * occ;
+   const bwt_t    * bwt;      // For 'create_occ_mt()'.
+   struct build_t * b;        // For 'create_index_mt()'.
+   const int64_t  * sa;       // For 'create_index_mt()'.
+   size_t           from;     // First position of the chunk.
+   size_t           to;       // Past the last position.
+   uint32_t         count[SIGMA];
+   uint32_t         base[SIGMA];
+};
+
+
+void
+run_threads
+(
+   void         * (*func)(void *),
+   void         * args,
+   const size_t   argsz,
+   const int      nthreads
+)
+// Run 'func' on 'nthreads' threads, thread 't' taking the argument
+// at 'args + t*argsz'. The arguments whose thread cannot be started
+// are processed by the calling thread.
+{
+   pthread_t tid[nthreads];
+   int started[nthreads];
+   for (int t = 0 ; t < nthreads ; t++) {
+      void * arg = (char *) args + t * argsz;
+      started[t] = nthreads > 1 &&
+         pthread_create(tid + t, NULL, func, arg) == 0;
+      if (!started[t]) func(arg);
+   }
+   for (int t = 0 ; t < nthreads ; t++)
+      if (started[t]) pthread_join(tid[t], NULL);
+}
+
+
+void
+split_chunks
+(
+   struct chunk_t * chunks,
+   const int        nthreads,
+   const size_t     txtlen,
+   const size_t     align
+)
+// Split the positions of the BWT in chunks whose boundaries
+// are multiples of 'align'.
+{
+   const size_t nalign = (txtlen + (align-1)) / align;
+   for (int t = 0 ; t < nthreads ; t++) {
+      size_t from = nalign * t / nthreads * align;
+      size_t to = nalign * (t+1) / nthreads * align;
+      chunks[t].from = from < txtlen ? from : txtlen;
+      chunks[t].to = to < txtlen ? to : txtlen;
+   }
+}
+
+
+void
+stitch_chunks
+(
+   struct chunk_t * chunks,
+   const int        nthreads,
+         uint32_t * total
+)
+// Exclusive prefix sum of the chunk counts. The total
+// counts are stored in 'total'.
+{
+   bzero(total, SIGMA * sizeof(uint32_t));
+   for (int t = 0 ; t < nthreads ; t++) {
+      for (int i = 0 ; i < SIGMA ; i++) {
+         chunks[t].base[i] = total[i];
+         total[i] += chunks[t].count[i];
+      }
+   }
+}
+
+
+void *
+fill_occ_chunk
+(
+   void * arg
+)
+{
+   struct chunk_t * chunk = arg;
+   bzero(chunk->count, sizeof(chunk->count));
+   fill_occ(chunk->occ, chunk->bwt, chunk->from, chunk->to, chunk->count);
+   return NULL;
+}
+
+
+void *
+shift_occ_chunk
+(
+   void * arg
+)
+// Add the counts of the previous chunks to the 'blocc_t' of a chunk.
+{
+   struct chunk_t * chunk = arg;
+   occ_t * occ = chunk->occ;
+   for (int i = 0 ; i < SIGMA ; i++) {
+      if (chunk->base[i] == 0) continue;
+      blocc_t * rows = occ->rows + i * occ->nrows;
+      for (size_t row = chunk->from/32 ; row*32 < chunk->to ; row++)
+         rows[row].smpl += chunk->base[i];
+   }
+   return NULL;
+}
+
+
+occ_t *
+create_occ
+(
+   bwt_t * bwt
+)
+{
+   return create_occ_mt(bwt, 1);
+}
+
+
+occ_t *
+create_occ_mt
+(
+   bwt_t * bwt,
+   int     nthreads
+)
+// Same as 'create_occ()' on 'nthreads' threads. The BWT is split in
+// chunks of whole 'blocc_t', each chunk is filled with local counts
+// and then shifted by the counts of the chunks before it.
+{
+
+   if (nthreads < 1) nthreads = 1;
+
+   // Allocate new 'Occ_t'.
+   occ_t * occ = alloc_occ(bwt->txtlen);
+
+   struct chunk_t chunks[nthreads];
+   split_chunks(chunks, nthreads, bwt->txtlen, 32);
+   for (int t = 0 ; t < nthreads ; t++) {
+      chunks[t].occ = occ;
+      chunks[t].bwt = bwt;
+   }
+
+   run_threads(fill_occ_chunk, chunks, sizeof(*chunks), nthreads);
+
+   uint32_t total[SIGMA];
+   stitch_chunks(chunks, nthreads, total);
+
+   if (nthreads > 1)
+      run_threads(shift_occ_chunk, chunks, sizeof(*chunks), nthreads);
+
+   // Write 'C'.
+   finish_occ(occ);
+
+   return occ;
+
+}
+
+
+// State of a fused build of the BWT, the Occ table and the
+// suffix array samples, between two chunks of suffix array.
+struct build_t {
+   const char  * txt;
+   bwt_t       * bwt;
+   occ_t       * occ;
+   csa_t       * csa;
+   uint32_t      smpl[SIGMA];
+   uint32_t      diff[SIGMA];
+   uint32_t      bits[SIGMA];
+};
+
+
+void
+fill_index
+(
+         struct build_t * b,
+   const int64_t        * sa,
+   const size_t           from,
+   const size_t           n
+)
+// Write the BWT, the Occ table and the suffix array samples at the
+// 'n' rows that start at 'from', in a single sweep over the entries
+// of the suffix array passed in 'sa'. Chunks must come in order.
+{
+
+   for (size_t pos = from ; pos < from + n ; pos++) {
+      const int64_t sfx = sa[pos - from];
+      if (sfx > 0) {
+         uint8_t c = ENCODE[(uint8_t) b->txt[sfx-1]];
+         b->bwt->slots[pos/4] |= c << 2*(pos % 4);
+         b->diff[c]++;
+         b->bits[c] |= (1U << (31 - pos % 32));
+      }
+      else {
+         // Record the position of the zero.
+         b->bwt->zero = pos;
+      }
+      if (pos % 32 == 31) {     // Write every 32 entries.
+         write_occ_blocks(b->occ, b->smpl, b->bits, pos/32);
+         memcpy(b->smpl, b->diff, SIGMA * sizeof(uint32_t));
+         bzero(b->bits, sizeof(b->bits));
+      }
+   }
+
+   fill_csa(b->csa, sa, from, n);
+
+}
+
+
+void
+init_build
+(
+         struct build_t * b,
+   const char           * txt
+)
+{
+   const size_t txtlen = strlen(txt) + 1;
+   *b = (struct build_t) {
+      .txt = txt,
+      .bwt = alloc_bwt(txtlen),
+      .occ = alloc_occ(txtlen),
+      .csa = alloc_csa(txtlen),
+   };
+}
+
+
+void
+finish_build
+(
+   struct build_t * b,
+   bwt_t         ** bwt,
+   occ_t         ** occ,
+   csa_t         ** csa
+)
+{
+   const size_t txtlen = b->bwt->txtlen;
+   if (txtlen % 32 != 0)
+      write_occ_blocks(b->occ, b->smpl, b->bits, (txtlen-1)/32);
+   finish_occ(b->occ);
+   *bwt = b->bwt;
+   *occ = b->occ;
+   *csa = b->csa;
+}
+
+
+void *
+fill_index_chunk
+(
+   void * arg
+)
+{
+   struct chunk_t * chunk = arg;
+   struct build_t * b = chunk->b;
+   fill_index(b, chunk->sa + chunk->from, chunk->from,
+         chunk->to - chunk->from);
+   // The last chunk writes the last (incomplete) block.
+   const size_t txtlen = b->bwt->txtlen;
+   if (chunk->from < chunk->to && chunk->to == txtlen && txtlen % 32 != 0)
+      write_occ_blocks(b->occ, b->smpl, b->bits, (txtlen-1)/32);
+   memcpy(chunk->count, b->diff, sizeof(chunk->count));
+   return NULL;
+}
+
+
+void
+create_index
+(
+   const char    * txt,
+   const int64_t * sa,
+         bwt_t  ** bwt,
+         occ_t  ** occ,
+         csa_t  ** csa
+)
+// Same as 'create_bwt()', 'create_occ()' and 'compress_sa()',
+// in a single pass over the suffix array.
+{
+   create_index_mt(txt, sa, 1, bwt, occ, csa);
+}
+
+
+void
+create_index_mt
+(
+   const char    * txt,
+   const int64_t * sa,
+         int       nthreads,
+         bwt_t  ** bwt,
+         occ_t  ** occ,
+         csa_t  ** csa
+)
+// Same as 'create_index()' on 'nthreads' threads. The suffix array
+// is split in chunks of 1024 rows, so that the chunks share neither
+// 'blocc_t' nor words of the compressed suffix array. The counts
+// of the Occ table are stitched as in 'create_occ_mt()'.
+{
+
+   if (nthreads < 1) nthreads = 1;
+
+   struct build_t b[nthreads];
+   init_build(b, txt);
+
+   struct chunk_t chunks[nthreads];
+   split_chunks(chunks, nthreads, b[0].bwt->txtlen, 1024);
+   for (int t = 0 ; t < nthreads ; t++) {
+      b[t] = b[0];
+      chunks[t].occ = b[0].occ;
+      chunks[t].b = b + t;
+      chunks[t].sa = sa;
+   }
+
+   run_threads(fill_index_chunk, chunks, sizeof(*chunks), nthreads);
+
+   uint32_t total[SIGMA];
+   stitch_chunks(chunks, nthreads, total);
+
+   if (nthreads > 1)
+      run_threads(shift_occ_chunk, chunks, sizeof(*chunks), nthreads);
+
+   finish_occ(b[0].occ);
+
+   *bwt = b[0].bwt;
+   *occ = b[0].occ;
+   *csa = b[0].csa;
+
+}
+
+
+void
+write_index_block
+(
+   const int64_t * blk,
+   const size_t    n,
+   const size_t    from,
+         void    * data
+)
+// Callback of 'sort_blocks()' for 'create_index_direct()'.
+{
+   fill_index((struct build_t *) data, blk, from, n);
+}
+
+
+void
+create_index_direct
+(
+   const char    * txt,
+   const size_t    budget,
+         bwt_t  ** bwt,
+         occ_t  ** occ,
+         csa_t  ** csa
+)
+// Same as 'create_index()', without ever holding the suffix array.
+// The suffixes are sorted by blocks of about 'budget' bytes and
+// the BWT, the Occ table and the samples are written from each
+// block.
+{
+   struct build_t b;
+   init_build(&b, txt);
+   sort_blocks(txt, budget, write_index_block, &b);
+   finish_build(&b, bwt, occ, csa);
+}
+
+
+KERNEL size_t
+count_line
+(
+   const line_t  * line,
+   const int       c,
+   const size_t    off
+)
+// Number of 'c' in the first 'off+1' symbols of the line, compared
+// 32 at a time with 'gather_symbols()'.
+{
+   const size_t last = off / 32;
+   size_t n = 0;
+   for (size_t i = 0 ; i < last ; i++)
+      n += __builtin_popcountl(gather_symbols(line->bwt[i], c));
+   const uint64_t mask = ~0ULL >> (62 - 2 * (off % 32));
+   return n + __builtin_popcountl(gather_symbols(line->bwt[last], c) & mask);
+}
+
+
+KERNEL size_t
+get_rank_packed
+(
+   const occ_t   * occ,
+   const int       c,
+   const size_t    pos
+)
+// Same as 'get_rank()' in the layout OCC_PACKED.
+{
+   const size_t l = pos / 192;
+   const line_t * line = (const line_t *) occ->rows + l;
+   uint64_t base = occ_super(occ)[(l >> OCC_LINE_SHIFT) * SIGMA + c];
+   size_t n = base + (uint32_t) (line->count[c] - (uint32_t) base) +
+      count_line(line, c, pos % 192);
+   // The '$' is stored as an 'A'.
+   n -= c == 0 && occ->zero <= pos && occ->zero / 192 == l;
+   return occ->C[c] + n;
+}
+
+
+KERNEL size_t
+get_rank_generic
+(
+   const occ_t   * occ,
+         uint8_t   c,
+         size_t    pos
+)
+{
+   if (occ->layout == OCC_PACKED)
+      return get_rank_packed(occ, c, pos);
+   const blocc_t * entry = occ_entry(occ, c, pos/32);
+   uint32_t smpl = entry->smpl;
+   uint32_t bits = entry->bits;
+   // The sample is relative to the superblock count, modulo 2^32.
+   uint64_t base = occ_super(occ)[(pos >> OCC_SUPER_SHIFT) * SIGMA + c];
+   // Several options for pop-count have been tested for this
+   // implementation. In the end, I chose '__builtin_popcountl' because
+   // the performance is good and the code is simple.
+   return occ->C[c] + base + (uint32_t) (smpl - (uint32_t) base) +
+      __builtin_popcountl(bits >> (31 - pos % 32));
+}
+
+DISPATCH(size_t, get_rank, (const occ_t * occ, uint8_t c, size_t pos),
+      return get_rank_generic(occ, c, pos))
+
+
+KERNEL void
+get_rank_all_generic
+(
+   const occ_t   * occ,
+         size_t    pos,
+         size_t  * rank
+)
+// Write the rank of every symbol at 'pos' to 'rank'. With the
+// layouts OCC_INTERLEAVED and OCC_PACKED, the entries are on the
+// same cache line and they cost a single miss.
+{
+   if (occ->layout == OCC_PACKED) {
+      for (int c = 0 ; c < SIGMA ; c++)
+         rank[c] = get_rank_packed(occ, c, pos);
+      return;
+   }
+   const uint64_t * base =
+      occ_super(occ) + (pos >> OCC_SUPER_SHIFT) * SIGMA;
+   for (int c = 0 ; c < SIGMA ; c++) {
+      const blocc_t * entry = occ_entry(occ, c, pos/32);
+      rank[c] = occ->C[c] + base[c] +
+         (uint32_t) (entry->smpl - (uint32_t) base[c]) +
+         __builtin_popcountl(entry->bits >> (31 - pos % 32));
+   }
+}
+
+DISPATCH(void, get_rank_all, (const occ_t * occ, size_t pos, size_t * rank),
+      get_rank_all_generic(occ, pos, rank))
+
+
+KERNEL range_t
+get_rank_range_generic
+(
+   const occ_t   * occ,
+   const uint8_t   c,
+   const range_t   range
+)
+// Return the range of the rows that start with 'c' followed by the
+// rows in 'range', i.e. one step of 'backward_search()'. When both
+// ends of the range are in the same line of the layout OCC_PACKED,
+// the line is loaded once for both ranks.
+{
+   // Row 0 ('$') is in the range of the empty query.
+   if (range.bot == 0) {
+      return (range_t) {
+         .bot = occ->C[c],
+         .top = get_rank_generic(occ, c, range.top) - 1
+      };
+   }
+   const size_t bot = range.bot - 1;
+   const size_t top = range.top;
+   // With 32 positions per entry, the second load hits the L1 cache
+   // and the test of the entry costs more than it saves. The line is
+   // shared only in the layout OCC_PACKED, where decoding is costly.
+   if (occ->layout != OCC_PACKED || !same_entry(occ, bot, top)) {
+      return (range_t) {
+         .bot = get_rank_generic(occ, c, bot),
+         .top = get_rank_generic(occ, c, top) - 1
+      };
+   }
+   const size_t l = top / 192;
+   const line_t * line = (const line_t *) occ->rows + l;
+   uint64_t base = occ_super(occ)[(l >> OCC_LINE_SHIFT) * SIGMA + c];
+   size_t n = occ->C[c] + base + (uint32_t) (line->count[c] - (uint32_t) base);
+   // The '$' is stored as an 'A'.
+   const int zero = c == 0 && occ->zero / 192 == l;
+   return (range_t) {
+      .bot = n + count_line(line, c, bot % 192) -
+         (zero && occ->zero <= bot),
+      .top = n + count_line(line, c, top % 192) -
+         (zero && occ->zero <= top) - 1
+   };
+}
+
+DISPATCH(range_t, get_rank_range,
+      (const occ_t * occ, const uint8_t c, const range_t range),
+      return get_rank_range_generic(occ, c, range))
+
+
+uint8_t
+get_symbol
+(
+   const bwt_t   * bwt,
+   const occ_t   * occ,
+         size_t    pos
+)
+// Return the symbol at 'pos' in the BWT. With the layout OCC_PACKED,
+// it is read from the Occ table and 'bwt' may have no slots.
+{
+   if (occ->layout == OCC_PACKED) {
+      const line_t * line = (const line_t *) occ->rows + pos / 192;
+      return line->bwt[pos % 192 / 32] >> 2*(pos % 32) & 0b11;
+   }
+   return bwt->slots[pos/4] >> 2*(pos % 4) & 0b11;
+}
+
+
+static occ_t *
+pack_occ
+(
+   const occ_t   * occ
+)
+// Same as 'layout_occ()' with the layout OCC_PACKED.
+{
+
+   occ_t header = *occ;
+   header.layout = OCC_PACKED;
+   header.nrows = (occ->txtlen + (192-1)) / 192;
+
+   occ_t * copy = calloc(1, occ_size(&header));
+   exit_on_memory_error(copy);
+   *copy = header;
+
+   line_t * lines = (line_t *) copy->rows;
+   uint64_t * super = occ_super(copy);
+   uint64_t total[SIGMA] = {0};
+
+   for (size_t l = 0 ; l < copy->nrows ; l++) {
+      if (l % (1ULL << OCC_LINE_SHIFT) == 0)
+         memcpy(super + (l >> OCC_LINE_SHIFT) * SIGMA, total,
+               sizeof(total));
+      for (int c = 0 ; c < SIGMA ; c++)
+         lines[l].count[c] = total[c];
+      // Decode the symbols from the bitfields (the most
+      // significant bit is the first position).
+      for (size_t j = 0 ; j < 6 && 6*l + j < occ->nrows ; j++) {
+         uint64_t w = 0;
+         for (int c = 0 ; c < SIGMA ; c++) {
+            uint32_t bits = occ_entry(occ, c, 6*l + j)->bits;
+            total[c] += __builtin_popcount(bits);
+            for ( ; bits ; bits &= bits - 1) {
+               const int p = 31 - __builtin_ctz(bits);
+               w |= (uint64_t) c << 2*p;
+            }
+         }
+         lines[l].bwt[j] = w;
+      }
+   }
+
+   return copy;
+
+}
+
+
+occ_t *
+layout_occ
+(
+   const occ_t   * occ,
+   const int       layout
+)
+// Return a copy of the Occ table with the given layout. The
+// table must not be in the layout OCC_PACKED, otherwise the
+// return value is NULL.
+{
+
+   if (occ->layout == OCC_PACKED) return NULL;
+   if (layout == OCC_PACKED) return pack_occ(occ);
+
+   occ_t * copy = malloc(occ_size(occ));
+   exit_on_memory_error(copy);
+
+   // The header and the superblock counts do not change.
+   memcpy(copy, occ, occ_size(occ));
+   copy->layout = layout;
+
+   for (size_t row = 0 ; row < occ->nrows ; row++) {
+      for (int c = 0 ; c < SIGMA ; c++) {
+         *(blocc_t *) occ_entry(copy, c, row) = *occ_entry(occ, c, row);
+      }
+   }
+
+   return copy;
+
+}
+
+
+lut_t *
+create_lut
+(
+   const occ_t  * occ,
+   const bwt_t  * bwt,
+   const size_t   k
+)
+// Create the lookup table of the k-mers of the text.
+{
+   return create_lut_mt(occ, bwt, k, 1);
+}
+
+
+lut_t *
+create_lut_mt
+(
+   const occ_t  * occ,
+   const bwt_t  * bwt,
+   const size_t   k,
+         int      nthreads
+)
+// Same as 'create_lut()' on 'nthreads' threads.
+{
+
+   if (nthreads < 1) nthreads = 1;
+
+   exit_if(k < LUT_MINK || k > LUT_MAXK);
+
+   // Rows fit on 32 bits up to 4 G, on 40 bits above. Pad
+   // the boundaries so that they can be read as 'uint64_t'.
+   const size_t width = occ->txtlen < (1ULL << 32) ? 4 : 5;
+   const size_t nbytes = width * ((1ULL << 2*k) + 1) + 8;
+
+   lut_t *lut = calloc(1, sizeof(lut_t) + nbytes);
+   exit_on_memory_error(lut);
+
+   lut->k = k;
+   lut->width = width;
+   lut->nbytes = nbytes;
+
+   // The suffixes at the end of the text that are shorter than 'k'
+   // are in the range of no k-mer. Find them by walking the BWT
+   // backward from '$'. They sort before the first k-mer they are
+   // a prefix of.
+   size_t row = 0;
+   size_t kmerid = 0;
+   for (size_t j = 0 ; j < k-1 && row != bwt->zero ; j++) {
+      uint8_t c = get_symbol(bwt, occ, row);
+      kmerid = (kmerid >> 2) | ((size_t) c << 2*(k-1));
+      lut->tail[lut->ntail++] = kmerid;
+      row = get_rank(occ, c, row) - 1;
+   }
+
+   fill_lut_mt(lut, occ, nthreads);
+
+   // The range of the last k-mer ends with the BWT.
+   const uint64_t end = htole64(occ->txtlen);
+   memcpy(lut->bound + width * (1ULL << 2*k), &end, width);
+
+   return lut;
+
+}
+
+
+void
+fill_lut
+(
+         lut_t   * lut,
+   const occ_t   * occ,
+   const range_t   range,
+   const size_t    depth,
+   const size_t    kmerid
+)
+// Write the first row of the k-mers that end with the k-mer
+// 'kmerid' of size 'depth', found at 'range' in the BWT. The
+// character prepended at depth 'd' goes to the bits '2d' of the
+// ID, so the IDs follow the lexicographic order.
+{
+   if (depth >= lut->k) {
+      const uint64_t bot = htole64(range.bot);
+      memcpy(lut->bound + lut->width * kmerid, &bot, lut->width);
+      return;
+   }
+   // Narrow ranges are within an entry, both ends are taken per
+   // symbol with 'get_rank_range()'.
+   if (range.bot > 0 && same_entry(occ, range.bot - 1, range.top)) {
+      for (uint8_t c = 0 ; c < SIGMA ; c++) {
+         fill_lut(lut, occ, get_rank_range(occ, c, range),
+               depth+1, kmerid + ((size_t) c << 2*depth));
+      }
+      return;
+   }
+   // All the symbols are needed, so get their ranks together.
+   size_t bot[SIGMA], top[SIGMA];
+   if (range.bot > 0) get_rank_all(occ, range.bot - 1, bot);
+   else memcpy(bot, occ->C, sizeof(bot));
+   get_rank_all(occ, range.top, top);
+   for (uint8_t c = 0 ; c < SIGMA ; c++) {
+      fill_lut(lut, occ, (range_t) { .bot=bot[c], .top=top[c]-1 },
+            depth+1, kmerid + ((size_t) c << 2*depth));
+   }
+}
+
+
+void
+fill_eytz
+(
+   const size_t     n,
+   const uint64_t * sorted,
+         uint64_t * eytz,
+         uint64_t * rank,
+         size_t   * i,
+   const size_t     k
+)
+// Copy 'sorted' to 'eytz' in Eytzinger layout, by an in-order
+// traversal of the implicit tree rooted at 'k'.
+{
+   if (k > n) return;
+   fill_eytz(n, sorted, eytz, rank, i, 2*k);
+   eytz[k] = sorted[*i];
+   rank[k] = (*i)++;
+   fill_eytz(n, sorted, eytz, rank, i, 2*k+1);
+}
+
+
+chr_t *
+create_chr
+(
+   const size_t   gsize,
+   const size_t   nchr,
+   const size_t * chrlen,
+   const char   * names,
+   const size_t   nseg,
+   const seg_t  * segs
+)
+// Create the table of the 'nchr' contigs of a genome whose forward
+// strand has size 'gsize' in the text. 'names' holds the names of
+// the contigs one after the other, each followed by a null
+// character. The text is made of the 'nseg' segments 'segs',
+// sorted by start.
+{
+
+   exit_if(nseg == 0 || segs[0].start != 0);
+
+   size_t namesz = 0;
+   for (size_t i = 0 ; i < nchr ; i++)
+      namesz += strlen(names + namesz) + 1;
+
+   // The rows of the junctions are left to 'find_junctions()'. Until
+   // then, they are all 0 (the row of '$'), which no query reaches.
+   size_t njct = gsize > 0;
+   for (size_t i = 1 ; i < nseg ; i++)
+      njct += 2 * (segs[i].start > segs[i-1].start && segs[i].start < gsize);
+
+   const size_t nwords = 5*nseg + 3 + 2*nchr + njct + (namesz + 7) / 8;
+   chr_t * chr = calloc(1, sizeof(chr_t) + nwords * sizeof(uint64_t));
+   exit_on_memory_error(chr);
+
+   chr->nchr = nchr;
+   chr->nseg = nseg;
+   chr->njct = njct;
+   chr->gsize = gsize;
+   chr->nbytes = nwords * sizeof(uint64_t);
+
+   uint64_t * start = chr->data;
+   uint64_t * eytz = start + nseg+1;
+   uint64_t * rank = eytz + nseg+1;
+   uint64_t * segchr = rank + nseg+1;
+   uint64_t * segoff = segchr + nseg;
+   uint64_t * len = segoff + nseg;
+   uint64_t * nameoff = len + nchr;
+   char * name = (char *) (nameoff + nchr + njct);
+
+   for (size_t i = 0 ; i < nseg ; i++) {
+      exit_if(i > 0 && segs[i].start < segs[i-1].start);
+      exit_if(segs[i].chr >= nchr);
+      start[i] = segs[i].start;
+      segchr[i] = segs[i].chr;
+      segoff[i] = segs[i].off;
+   }
+   start[nseg] = gsize;
+
+   size_t i = 0;
+   fill_eytz(nseg, start, eytz, rank, &i, 1);
+
+   namesz = 0;
+   for (size_t i = 0 ; i < nchr ; i++) {
+      len[i] = chrlen[i];
+      nameoff[i] = namesz;
+      namesz += strlen(names + namesz) + 1;
+   }
+   memcpy(name, names, namesz);
+
+   return chr;
+
+}
+
+
+void
+find_junctions
+(
+   chr_t  * chr,
+   csa_t  * csa,
+   bwt_t  * bwt,
+   occ_t  * occ
+)
+// Fill the rows of the junctions of 'chr' in the index. The row of a
+// junction is reached by walking the BWT backward from the closest
+// sampled suffix that starts at or after it.
+{
+
+   const size_t njct = chr->njct;
+   if (njct == 0) return;
+
+   const uint64_t * start = chr->data;
+   const size_t gsize = chr->gsize;
+   uint64_t * jrow = chr->data + 5*chr->nseg + 3 + 2*chr->nchr;
+
+   // Positions of the junctions in the text, sorted.
+   size_t * jpos = malloc(njct * sizeof(size_t));
+   size_t * dist = malloc(njct * sizeof(size_t));
+   exit_on_memory_error(jpos);
+   exit_on_memory_error(dist);
+   size_t n = 0;
+   for (size_t i = 1 ; i < chr->nseg ; i++)
+      if (start[i] > start[i-1] && start[i] < gsize) jpos[n++] = start[i];
+   jpos[n++] = gsize;
+   for (size_t i = n-1 ; i > 0 ; i--) jpos[n++] = 2*gsize - jpos[i-1];
+
+   // The row of the suffix '$' (the last sampled position) is sampled,
+   // so every junction is followed by a sample.
+   for (size_t j = 0 ; j < njct ; j++) dist[j] = SIZE_MAX;
+   for (size_t row = 0 ; row < bwt->txtlen ; row += 16) {
+      const size_t pos = query_csa(csa, bwt, occ, row);
+      // Find the last junction at or before 'pos'.
+      size_t lo = 0, hi = njct;
+      while (lo < hi) {
+         const size_t mid = (lo + hi) / 2;
+         if (jpos[mid] <= pos) lo = mid+1;
+         else hi = mid;
+      }
+      if (lo > 0 && pos - jpos[lo-1] < dist[lo-1]) {
+         dist[lo-1] = pos - jpos[lo-1];
+         jrow[lo-1] = row;
+      }
+   }
+
+   // Walk back to the junctions, from the next junction if it is
+   // closer than the sample.
+   for (size_t j = njct ; j-- > 0 ; ) {
+      if (j+1 < njct && jpos[j+1] - jpos[j] < dist[j]) {
+         dist[j] = jpos[j+1] - jpos[j];
+         jrow[j] = jrow[j+1];
+      }
+      size_t row = jrow[j];
+      for (size_t i = 0 ; i < dist[j] ; i++)
+         row = get_rank(occ, get_symbol(bwt, occ, row), row) - 1;
+      jrow[j] = row;
+   }
+
+   free(jpos);
+   free(dist);
+
+   qsort(jrow, njct, sizeof(uint64_t), compare_rows);
+
+}
+
+
+// Arguments of the threads of 'fill_lut_mt()'.
+struct lut_job_t {
+   lut_t       * lut;
+   const occ_t * occ;
+   size_t        depth;     // Depth of the split.
+   size_t        from;      // First k-mer suffix of the thread.
+   size_t        to;        // Past the last k-mer suffix.
+};
+
+
+void *
+fill_lut_job
+(
+   void * arg
+)
+{
+   struct lut_job_t * job = arg;
+   const occ_t * occ = job->occ;
+   for (size_t kmerid = job->from ; kmerid < job->to ; kmerid++) {
+      // Search the 'depth' last characters of the k-mers.
+      range_t range = { .bot = 0, .top = occ->txtlen-1 };
+      for (size_t d = 0 ; d < job->depth ; d++) {
+         uint8_t c = kmerid >> 2*d & 0b11;
+         range = get_rank_range(occ, c, range);
+      }
+      fill_lut(job->lut, occ, range, job->depth, kmerid);
+   }
+   return NULL;
+}
+
+
+void
+fill_lut_mt
+(
+         lut_t * lut,
+   const occ_t * occ,
+         int     nthreads
+)
+// Same as 'fill_lut()' from the root, on 'nthreads' threads. The
+// recursion is split at a shallow depth and each thread takes a
+// contiguous range of the k-mer suffixes of that depth. They are in
+// the low bits of the IDs, so the threads write interleaved entries
+// of 'lut->bound'. With at least 16 suffixes per thread, the threads
+// share only the cache lines at the ends of their ranges.
+{
+
+   if (nthreads < 1) nthreads = 1;
+
+   size_t depth = 0;
+   while (depth < lut->k && (1ULL << 2*depth) < 16 * nthreads) depth++;
+   const size_t nsfx = 1ULL << 2*depth;
+
+   struct lut_job_t jobs[nthreads];
+   for (int t = 0 ; t < nthreads ; t++) {
+      jobs[t] = (struct lut_job_t) {
+         .lut = lut,
+         .occ = occ,
+         .depth = depth,
+         .from = nsfx * t / nthreads,
+         .to = nsfx * (t+1) / nthreads,
+      };
+   }
+
+   run_threads(fill_lut_job, jobs, sizeof(*jobs), nthreads);
+
+}
+
+
+// SECTION 2.2 QUERY FUNCTIONS //
+
+range_t
+lookup_lut
+(
+   const lut_t  * lut,
+   const size_t   kmerid
+)
+// Return the range of k-mer 'kmerid' in the BWT.
+{
+   const uint64_t mask = (1ULL << 8*lut->width) - 1;
+   uint64_t bot, next;
+   memcpy(&bot, lut->bound + lut->width * kmerid, sizeof(uint64_t));
+   memcpy(&next, lut->bound + lut->width * (kmerid+1), sizeof(uint64_t));
+   size_t top = (le64toh(next) & mask) - 1;
+   for (int i = 0 ; i < lut->ntail ; i++)
+      top -= lut->tail[i] == kmerid+1;
+   return (range_t) { .bot = le64toh(bot) & mask, .top = top };
+}
+
+
+KERNEL range_t
+backward_search_generic
+(
+   const char   * query,
+   const size_t   len,
+   const occ_t  * occ,
+   const lut_t  * lut
+)
+// Used to search a substring using 'occ' and 'C'.
+// In case the query is not found, the condition
+// 'range.top - range.bot == -1' is true. If 'lut' is
+// not NULL, the range of the last 'lut->k' characters
+// of the query is read from the lookup table. Queries
+// with symbols outside the alphabet are not found.
+{
+
+   range_t range = { .bot = 0, .top = occ->txtlen-1 };
+   int offset = 0;
+
+   if (lut != NULL && len >= lut->k) {
+      // Same k-mer ID as in 'fill_lut()'.
+      size_t merid = 0;
+      for (int i = 0 ; i < lut->k ; i++) {
+         if (NONALPHABET[(uint8_t) query[len-lut->k+i]])
+            return (range_t) { .bot = 1, .top = 0 };
+         merid = (merid << 2) + ENCODE[(uint8_t) query[len-lut->k+i]];
+      }
+      range = lookup_lut(lut, merid);
+      if (range.top < range.bot)
+         return range;
+      offset = lut->k;
+   }
+
+   for ( ; offset < len ; offset++) {
+      // The text has no symbol outside the alphabet.
+      if (NONALPHABET[(uint8_t) query[len-offset-1]])
+         return (range_t) { .bot = 1, .top = 0 };
+      int c = ENCODE[(uint8_t) query[len-offset-1]];
+      range = get_rank_range_generic(occ, c, range);
+      if (range.top < range.bot)
+         return range;
+   }
+
+   return range;
+
+}
+
+DISPATCH(range_t, backward_search,
+      (const char * query, const size_t len, const occ_t * occ,
+       const lut_t * lut),
+      return backward_search_generic(query, len, occ, lut))
+
+
+// State of a query in 'backward_search_batch()'.
+struct lane_t {
+   const char   * query;
+   size_t         len;
+   size_t         id;        // Index of the query in the batch.
+   size_t         offset;    // Characters already searched.
+   int            c;         // Next character.
+   range_t        range;
+};
+
+
+static int
+next_symbol
+(
+   struct lane_t  * lane,
+   const occ_t    * occ,
+         range_t  * out
+)
+// Prefetch the Occ entries of the next step of the lane, or
+// write the range of the query to 'out' and return 0 if done.
+{
+   if (lane->offset == lane->len) {
+      out[lane->id] = lane->range;
+      return 0;
+   }
+   const uint8_t sym = lane->query[lane->len-lane->offset-1];
+   if (NONALPHABET[sym]) {
+      out[lane->id] = (range_t) { .bot = 1, .top = 0 };
+      return 0;
+   }
+   lane->c = ENCODE[sym];
+   if (lane->range.bot > 0)
+      __builtin_prefetch(occ_addr(occ, lane->c, lane->range.bot-1));
+   __builtin_prefetch(occ_addr(occ, lane->c, lane->range.top));
+   return 1;
+}
+
+
+static int
+start_lane
+(
+   struct lane_t       * lane,
+   const char * const  * query,
+   const size_t        * len,
+   const size_t          n,
+         size_t        * next,
+   const occ_t         * occ,
+   const lut_t         * lut,
+         range_t       * out
+)
+// Load the next query that is not solved by the lookup table in
+// the lane. Return 0 if there is no such query left.
+{
+   while (*next < n) {
+      const size_t id = (*next)++;
+      *lane = (struct lane_t) { .query = query[id], .len = len[id],
+         .id = id, .range = { .bot = 0, .top = occ->txtlen-1 } };
+      if (lut != NULL && lane->len >= lut->k) {
+         // Same as in 'backward_search()'.
+         const char * kmer = lane->query + lane->len - lut->k;
+         size_t merid = 0;
+         int i;
+         for (i = 0 ; i < lut->k ; i++) {
+            if (NONALPHABET[(uint8_t) kmer[i]]) break;
+            merid = (merid << 2) + ENCODE[(uint8_t) kmer[i]];
+         }
+         if (i < lut->k) {
+            out[id] = (range_t) { .bot = 1, .top = 0 };
+            continue;
+         }
+         lane->range = lookup_lut(lut, merid);
+         if (lane->range.top < lane->range.bot) {
+            out[id] = lane->range;
+            continue;
+         }
+         lane->offset = lut->k;
+      }
+      if (next_symbol(lane, occ, out)) return 1;
+   }
+   return 0;
+}
+
+
+KERNEL void
+backward_search_batch_generic
+(
+   const char * const  * query,
+   const size_t        * len,
+   const size_t          n,
+   const occ_t         * occ,
+   const lut_t         * lut,
+         range_t       * out
+)
+// Same as 'backward_search()' on 'n' queries, writing the ranges to
+// 'out'. The queries are advanced in lockstep, by groups of 'LANES':
+// the Occ entries of the next step of a query are prefetched when
+// its current step is done, so they arrive while the other queries
+// are advanced and the cache misses of the group overlap.
+{
+
+   struct lane_t lane[LANES];
+   size_t next = 0;
+   size_t nlanes = 0;
+
+   while (nlanes < LANES &&
+         start_lane(lane + nlanes, query, len, n, &next, occ, lut, out))
+      nlanes++;
+
+   while (nlanes > 0) {
+      for (size_t i = 0 ; i < nlanes ; ) {
+         struct lane_t * l = lane + i;
+         l->range = get_rank_range_generic(occ, l->c, l->range);
+         l->offset++;
+         if (l->range.top < l->range.bot)
+            out[l->id] = l->range;
+         else if (next_symbol(l, occ, out)) {
+            i++;
+            continue;
+         }
+         // The query is done, replace it.
+         if (start_lane(l, query, len, n, &next, occ, lut, out)) i++;
+         else *l = lane[--nlanes];
+      }
+   }
+
+}
+
+DISPATCH(void, backward_search_batch,
+      (const char * const * query, const size_t * len, const size_t n,
+       const occ_t * occ, const lut_t * lut, range_t * out),
+      backward_search_batch_generic(query, len, n, occ, lut, out))
+
+
+size_t
+find_seg
+(
+   const chr_t  * chr,
+   const size_t   pos
+)
+// Return the index of the segment that contains 'pos' on the
+// forward strand, with a branch-free search in Eytzinger layout.
+// Empty segments are never returned.
+{
+   const uint64_t * eytz = chr->data + chr->nseg+1;
+   const uint64_t * rank = eytz + chr->nseg+1;
+   // Find the first start greater than 'pos'.
+   size_t k = 1;
+   while (k <= chr->nseg) {
+      __builtin_prefetch(eytz + 16*k);
+      k = 2*k + (eytz[k] <= pos);
+   }
+   k >>= __builtin_ffsll(~k);
+   return (k == 0 ? chr->nseg : rank[k]) - 1;
+}
+
+
+int
+translate_pos
+(
+   const chr_t   * chr,
+   const size_t    txtpos,
+   const size_t    len,
+         locus_t * locus
+)
+// Translate the position in the text of a hit of size 'len' to a
+// position on a contig. Hits on the reverse complement are reported
+// at their leftmost position on the forward strand. Return 0 if the
+// hit straddles the end of a segment (i.e. a gap, the junction of two
+// contigs or of the two strands), in which case 'locus' is not set,
+// and 1 otherwise.
+{
+   const size_t gsize = chr->gsize;
+   size_t pos = txtpos;
+   char strand = '+';
+   if (txtpos >= gsize) {
+      // Reverse complement.
+      if (txtpos + len > 2*gsize) return 0;
+      pos = 2*gsize - txtpos - len;
+      strand = '-';
+   }
+   else if (txtpos + len > gsize) {
+      return 0;
+   }
+   const size_t i = find_seg(chr, pos);
+   const uint64_t * start = chr->data;
+   const uint64_t * segchr = start + 3*(chr->nseg+1);
+   const uint64_t * segoff = segchr + chr->nseg;
+   if (pos + len > start[i+1]) return 0;
+   *locus = (locus_t) {
+      .chr = segchr[i],
+      .pos = segoff[i] + pos - start[i],
+      .strand = strand
+   };
+   return 1;
+}
+
+
+size_t
+locate
+(
+         csa_t   * csa,
+         bwt_t   * bwt,
+         occ_t   * occ,
+   const chr_t   * chr,
+   const range_t   range,
+   const char    * query,
+   const size_t    len,
+   const int       mode,
+         locus_t * loci,
+   const size_t    max
+)
+// Write in 'loci' the positions of the hits of 'query' (of size 'len')
+// found at 'range', folded to the forward strand. Hits of the query
+// on the reverse complement are reported on the '-' strand. Hits that
+// straddle the end of a segment are skipped. Return the number of
+// loci written, up to 'max'.
+//
+// With mode 'LOCATE_PAIR', each hit is followed by the corresponding
+// hit of the reverse complement of the query, at the same position on
+// the other strand. The range of the reverse complement contains the
+// mirrors of the hits in 'range', so it need not be walked. When the
+// query is its own reverse complement, the two ranges are the same
+// and the hits are not mirrored.
+{
+   int mirror = mode == LOCATE_PAIR;
+   if (mirror) {
+      size_t i = 0;
+      while (i < len && query[i] == REVCOMP[(uint8_t) query[len-1-i]]) i++;
+      mirror = i < len;
+   }
+   size_t n = 0;
+   const size_t step = mirror ? 2 : 1;
+   for (size_t row = range.bot ; row <= range.top ; row++) {
+      if (n + step > max) break;
+      size_t pos = query_csa(csa, bwt, occ, row);
+      if (!translate_pos(chr, pos, len, loci + n)) continue;
+      if (mirror) {
+         loci[n+1] = loci[n];
+         loci[n+1].strand = loci[n].strand == '+' ? '-' : '+';
+      }
+      n += step;
+   }
+   return n;
+}
+
+
+static size_t
+find_junction
+(
+   const chr_t  * chr,
+   const size_t   row
+)
+// Return the index of the first junction at or after 'row' in the
+// rows of the junctions (or 'chr->njct' if there is none).
+{
+   const uint64_t * jrow = chr->data + 5*chr->nseg + 3 + 2*chr->nchr;
+   size_t lo = 0, hi = chr->njct;
+   while (lo < hi) {
+      const size_t mid = (lo + hi) / 2;
+      if (jrow[mid] < row) lo = mid+1;
+      else hi = mid;
+   }
+   return lo;
+}
+
+
+static int
+straddles
+(
+   const occ_t  * occ,
+   const chr_t  * chr,
+   const size_t   row,
+   const char   * query,
+   const size_t   i
+)
+// Return 1 if the suffix at 'row', which starts at a junction with
+// 'query+i', is preceded by the first 'i' characters of the query,
+// i.e. if the query has a hit across that junction, and 0 otherwise.
+// Hits that straddle several junctions are counted at the first.
+{
+   const uint64_t * jrow = chr->data + 5*chr->nseg + 3 + 2*chr->nchr;
+   range_t range = { .bot = row, .top = row };
+   for (size_t j = i ; j-- > 0 ; ) {
+      range = get_rank_range(occ, ENCODE[(uint8_t) query[j]], range);
+      if (range.top < range.bot) return 0;
+      if (j > 0) {
+         const size_t k = find_junction(chr, range.bot);
+         if (k < chr->njct && jrow[k] == range.bot) return 0;
+      }
+   }
+   return 1;
+}
+
+
+size_t
+count_hits
+(
+   const char    * query,
+   const size_t    len,
+   const range_t   range,
+   const occ_t   * occ,
+   const chr_t   * chr
+)
+// Return the number of hits of 'query' (of size 'len') found at
+// 'range' by 'backward_search()', without those that straddle a
+// junction (see 'chr_t'). The query is searched again, and the
+// junctions in the range of each of its suffixes are checked by
+// extending them with the rest of the query. There are few of them,
+// so the cost is about that of 'backward_search()' without a LUT.
+{
+   if (range.top < range.bot) return 0;
+   size_t n = range.top - range.bot + 1;
+   if (chr == NULL || chr->njct == 0 || len < 2) return n;
+   const uint64_t * jrow = chr->data + 5*chr->nseg + 3 + 2*chr->nchr;
+   range_t sfx = { .bot = 0, .top = occ->txtlen-1 };
+   for (size_t i = len-1 ; i > 0 ; i--) {
+      sfx = get_rank_range(occ, ENCODE[(uint8_t) query[i]], sfx);
+      for (size_t k = find_junction(chr, sfx.bot) ;
+            k < chr->njct && jrow[k] <= sfx.top ; k++)
+         n -= straddles(occ, chr, jrow[k], query, i);
+   }
+   return n;
+}
+
+
+const char *
+chr_name
+(
+   const chr_t  * chr,
+   const size_t   i
+)
+{
+   const uint64_t * nameoff = chr->data + 5*chr->nseg + 3 + chr->nchr;
+   return (const char *) (nameoff + chr->nchr + chr->njct) + nameoff[i];
+}
+
+
+size_t
+chr_len
+(
+   const chr_t  * chr,
+   const size_t   i
+)
+{
+   return chr->data[5*chr->nseg + 3 + i];
+}
+
+
+size_t
+query_csa
+(
+   csa_t  * csa,
+   bwt_t  * BWT,
+   occ_t  * occ,
+   size_t   pos
+)
+{
+
+   if (pos == BWT->zero) return 0;
+   if (pos % 16 == 0) {
+      // Value is sampled. Extract it.
+      size_t idx = pos / 16;
+      size_t lo  = csa->nbits * idx;
+      size_t hi  = csa->nbits * (idx+1)-1;
+      if (lo/64 == hi/64) {
+         // Entry fits in a single 'uint64_t'.
+         // Use mask to extract the n-bit encoding of the position.
+         return (size_t) csa->bitf[lo/64] >> lo % 64 & csa->bmask;
+      }
+      else {
+         // Entry is split between two 'uint64_t'.
+         size_t lo_bits = (size_t) csa->bitf[lo/64] >> lo % 64;
+         size_t hi_bits = (size_t) csa->bitf[hi/64] << (64-lo) % 64;
+         return (lo_bits | hi_bits) & csa->bmask;
+      }
+   }
+   uint8_t c = get_symbol(BWT, occ, pos);
+   size_t nextpos = get_rank(occ, c, pos) - 1;
+   return query_csa(csa, BWT, occ, nextpos) + 1;
+
+}
+
+
+// SECTION 2.3 INDEX FILES //
+
+uint64_t
+fnv1a
+(
+   const void   * data,
+   const size_t   len
+)
+// 64-bit FNV-1a hash of 'len' bytes.
+{
+   const uint8_t * bytes = data;
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   for (size_t i = 0 ; i < len ; i++) {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ULL;
+   }
+   return hash;
+}
+
+
+void
+write_index
+(
+   const char    * fname,
+   const index_t * idx
+)
+// Write the index to the file 'fname' (see 'idxhdr_t').
+{
+
+   const void * data[IDX_NSECT] = {
+      idx->bwt, idx->occ, idx->csa, idx->lut, idx->chr
+   };
+   size_t size[IDX_NSECT] = {
+      sizeof(bwt_t) + idx->bwt->nslots * sizeof(uint8_t),
+      occ_size(idx->occ),
+      sizeof(csa_t) + idx->csa->nint64 * sizeof(int64_t),
+      idx->lut == NULL ? 0 : sizeof(lut_t) + idx->lut->nbytes,
+      idx->chr == NULL ? 0 : sizeof(chr_t) + idx->chr->nbytes,
+   };
+
+   idxhdr_t hdr = {
+      .magic = IDX_MAGIC,
+      .version = IDX_VERSION,
+      .endian = IDX_ENDIAN,
+      .txtlen = idx->bwt->txtlen,
+      .nsect = IDX_NSECT,
+   };
+
+   // Place the sections after the header.
+   uint64_t offset = IDX_ALIGN;
+   for (int i = 0 ; i < IDX_NSECT ; i++) {
+      hdr.sect[i].offset = size[i] > 0 ? offset : 0;
+      hdr.sect[i].size = size[i];
+      offset += (size[i] + IDX_ALIGN-1) / IDX_ALIGN * IDX_ALIGN;
+   }
+   hdr.checksum = fnv1a(&hdr, offsetof(idxhdr_t, checksum));
+
+   int fd = creat(fname, 0644);
+   if (fd < 0) exit_cannot_open(fname);
+
+   // The padding between the sections is left as holes.
+   exit_if(ftruncate(fd, offset) != 0);
+   exit_if(pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr));
+   for (int i = 0 ; i < IDX_NSECT ; i++) {
+      size_t ws = 0;
+      while (ws < size[i]) {
+         ssize_t w = pwrite(fd, (const char *) data[i] + ws,
+               size[i] - ws, hdr.sect[i].offset + ws);
+         exit_if(w <= 0);
+         ws += w;
+      }
+   }
+
+   close(fd);
+
+}
+
+
+int
+parse_index
+(
+   const void    * map,
+   const size_t    mapsz,
+         index_t * idx
+)
+// Check the index mapped at 'map' and point the parts of 'idx'
+// to its sections. Return 0 on success and -1 if the index is
+// invalid, stale or written on a host with another byte order.
+{
+
+   #define reject(x) do { if (x) { fprintf(stderr, \
+         "invalid index: %s\n", #x); return -1; }} while(0)
+
+   const idxhdr_t * hdr = map;
+   reject(mapsz < sizeof(idxhdr_t));
+   reject(memcmp(hdr->magic, IDX_MAGIC, 8) != 0);
+   reject(hdr->version != IDX_VERSION);
+   reject(hdr->endian != IDX_ENDIAN);
+   reject(hdr->checksum != fnv1a(hdr, offsetof(idxhdr_t, checksum)));
+   reject(hdr->nsect != IDX_NSECT);
+
+   const char * sect[IDX_NSECT];
+   for (int i = 0 ; i < IDX_NSECT ; i++) {
+      const sect_t s = hdr->sect[i];
+      sect[i] = s.size == 0 ? NULL : (const char *) map + s.offset;
+      reject(s.offset % IDX_ALIGN != 0);
+      reject(s.offset > mapsz || s.size > mapsz - s.offset);
+   }
+
+   reject(sect[IDX_BWT] == NULL);
+   reject(sect[IDX_OCC] == NULL);
+   reject(sect[IDX_CSA] == NULL);
+
+   idx->bwt = (bwt_t *) sect[IDX_BWT];
+   idx->occ = (occ_t *) sect[IDX_OCC];
+   idx->csa = (csa_t *) sect[IDX_CSA];
+   idx->lut = (lut_t *) sect[IDX_LUT];
+   idx->chr = (chr_t *) sect[IDX_CHR];
+
+   // Check that the sections are complete and that their parameters
+   // are those derived from the length of the text. The checksum
+   // covers only the header, so a corrupt body must not get through
+   // and lead to reads out of bounds.
+   #define sectsz(i) (hdr->sect[i].size)
+   const size_t txtlen = hdr->txtlen;
+   reject(txtlen < 1);
+
+   const bwt_t * bwt = idx->bwt;
+   reject(sectsz(IDX_BWT) < sizeof(bwt_t) || sectsz(IDX_BWT) !=
+         sizeof(bwt_t) + bwt->nslots * sizeof(uint8_t));
+   reject(bwt->txtlen != txtlen);
+   reject(bwt->zero >= txtlen);
+
+   const occ_t * occ = idx->occ;
+   reject(sectsz(IDX_OCC) < sizeof(occ_t));
+   reject(occ->txtlen != txtlen);
+   reject(occ->zero != bwt->zero);
+   reject(occ->layout != OCC_SPLIT &&
+         occ->layout != OCC_INTERLEAVED &&
+         occ->layout != OCC_PACKED);
+   const size_t span = occ->layout == OCC_PACKED ? 192 : 32;
+   reject(occ->nrows != (txtlen + (span-1)) / span);
+   reject(sectsz(IDX_OCC) != occ_size(occ));
+   reject(occ->C[0] != 1 || occ->C[SIGMA] != txtlen);
+   for (int i = 0 ; i < SIGMA ; i++)
+      reject(occ->C[i] > occ->C[i+1]);
+   // The BWT can be left out of the index with the layout OCC_PACKED.
+   reject(occ->layout != OCC_PACKED && bwt->nslots != (txtlen + 3) / 4);
+
+   const csa_t * csa = idx->csa;
+   size_t nbits = 0;
+   while (txtlen > ((uint64_t) 1 << nbits)) nbits++;
+   reject(sectsz(IDX_CSA) < sizeof(csa_t) || sectsz(IDX_CSA) !=
+         sizeof(csa_t) + csa->nint64 * sizeof(int64_t));
+   reject(csa->nbits != nbits);
+   reject(csa->bmask != ((uint64_t) 0xFFFFFFFFFFFFFFFF) >> (64-nbits));
+   reject(csa->nint64 != (nbits * ((txtlen + 15) / 16) + 63) / 64);
+
+   const lut_t * lut = idx->lut;
+   if (lut != NULL) {
+      reject(sectsz(IDX_LUT) < sizeof(lut_t) ||
+            sectsz(IDX_LUT) != sizeof(lut_t) + lut->nbytes);
+      reject(lut->k < LUT_MINK || lut->k > LUT_MAXK);
+      reject(lut->width != (txtlen < (1ULL << 32) ? 4 : 5));
+      reject(lut->nbytes != lut->width * ((1ULL << 2*lut->k) + 1) + 8);
+      reject(lut->ntail > lut->k - 1);
+      for (size_t i = 0 ; i < lut->ntail ; i++)
+         reject(lut->tail[i] >= (1ULL << 2*lut->k));
+   }
+
+   const chr_t * chr = idx->chr;
+   if (chr != NULL) {
+      reject(sectsz(IDX_CHR) < sizeof(chr_t) ||
+            sectsz(IDX_CHR) != sizeof(chr_t) + chr->nbytes);
+      reject(2 * chr->gsize + 1 != txtlen);
+      reject(chr->nseg == 0 || chr->nseg > txtlen || chr->nchr > txtlen);
+      // The names take at least one word, with a null at the end.
+      const size_t nwords = chr->nbytes / sizeof(uint64_t);
+      reject(chr->nbytes % sizeof(uint64_t) != 0);
+      reject(chr->njct > 2 * chr->nseg);
+      reject(nwords < 5*chr->nseg + 3 + 2*chr->nchr + chr->njct +
+            (chr->nchr > 0));
+      reject(((const char *) chr->data)[chr->nbytes-1] != '\0');
+      const uint64_t * start = chr->data;
+      const uint64_t * eytz = start + chr->nseg+1;
+      const uint64_t * rank = eytz + chr->nseg+1;
+      const uint64_t * segchr = rank + chr->nseg+1;
+      const uint64_t * nameoff = segchr + 2*chr->nseg + chr->nchr;
+      const uint64_t * jrow = nameoff + chr->nchr;
+      const size_t namesz = 8 * (nwords - (jrow + chr->njct - start));
+      reject(start[0] != 0 || start[chr->nseg] != chr->gsize);
+      for (size_t i = 0 ; i < chr->nseg ; i++) {
+         reject(start[i] > start[i+1]);
+         reject(segchr[i] >= chr->nchr);
+         reject(rank[i+1] >= chr->nseg || eytz[i+1] != start[rank[i+1]]);
+      }
+      for (size_t i = 0 ; i < chr->nchr ; i++)
+         reject(nameoff[i] >= namesz);
+      for (size_t i = 0 ; i < chr->njct ; i++)
+         reject(jrow[i] >= txtlen || (i > 0 && jrow[i] < jrow[i-1]));
+   }
+   #undef sectsz
+   #undef reject
+
+   return 0;
+
+}
+
+
+int
+same_index
+(
+   const char   * fname,
+   const void   * map,
+   const size_t   mapsz
+)
+// Return 1 if the file 'fname' has the size 'mapsz' and the same
+// header as the index mapped at 'map', and 0 otherwise.
+{
+   idxhdr_t hdr;
+   struct stat st;
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) return 0;
+   int same = fstat(fd, &st) == 0 && (size_t) st.st_size == mapsz &&
+      mapsz >= sizeof(hdr) && pread(fd, &hdr, sizeof(hdr), 0) ==
+      sizeof(hdr) && memcmp(&hdr, map, sizeof(hdr)) == 0;
+   close(fd);
+   return same;
+}
+
+
+int
+load_index
+(
+   const char    * fname,
+   const int       policy,
+         index_t * idx
+)
+// Load the index in the file 'fname' with the given policy:
+//   - LOAD_POPULATE maps the file and faults all the pages in,
+//   - LOAD_LAZY maps the file and lets the pages fault in on first
+//     access; the Occ table and the SA samples are accessed at
+//     random, so read-ahead is disabled on them,
+//   - LOAD_COPY reads the file in anonymous memory aligned on 2 MB,
+//     where the kernel can use transparent huge pages,
+//   - LOAD_HUGETLB and LOAD_HUGETLB_1G read the file in memory backed
+//     by reserved huge pages of 2 MB and 1 GB; the random accesses to
+//     the Occ table then miss the TLB much less often,
+//   - LOAD_SHARED attaches the shared memory segment created for the
+//     file by 'share_index()'; only the header of the file is read,
+//     and the segment is rejected if its header is not the same.
+// The time to load and the resident size are recorded in 'idx'.
+// Return 0 on success and -1 on failure.
+{
+
+   struct timespec t0, t1;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+
+   char name[256];
+   int fd = -1;
+   if (policy == LOAD_SHARED) {
+      if (index_shm_name(fname, name, sizeof(name)) == 0)
+         fd = shm_open(name, O_RDONLY, 0);
+   }
+   else {
+      fd = open(fname, O_RDONLY);
+   }
+   if (fd < 0) {
+      fprintf(stderr, "cannot open %s '%s'\n", policy == LOAD_SHARED ?
+            "shared memory segment" : "file", fname);
+      return -1;
+   }
+
+   const size_t fsz = lseek(fd, 0, SEEK_END);
+   char * map = MAP_FAILED;
+   size_t mapsz = fsz;
+
+   switch (policy) {
+   case LOAD_POPULATE:
+      map = mmap(NULL, fsz, PROT_READ, MMAP_FLAGS, fd, 0);
+      break;
+   case LOAD_LAZY:
+      map = mmap(NULL, fsz, PROT_READ, MAP_PRIVATE, fd, 0);
+      break;
+   case LOAD_SHARED:
+      map = mmap(NULL, fsz, PROT_READ, MAP_SHARED, fd, 0);
+      break;
+   case LOAD_COPY: {
+      // Over-allocate and trim the ends to align the mapping.
+      mapsz = (fsz + IDX_ALIGN-1) / IDX_ALIGN * IDX_ALIGN;
+      char * raw = mmap(NULL, mapsz + IDX_ALIGN, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED) break;
+      map = raw + (IDX_ALIGN - (uintptr_t) raw % IDX_ALIGN) % IDX_ALIGN;
+      if (map > raw) munmap(raw, map - raw);
+      munmap(map + mapsz, raw + IDX_ALIGN - map);
+#ifdef MADV_HUGEPAGE
+      madvise(map, mapsz, MADV_HUGEPAGE);
+#endif
+      break;
+   }
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+   case LOAD_HUGETLB:
+   case LOAD_HUGETLB_1G: {
+      // Huge pages must be reserved by the administrator
+      // (see '/sys/kernel/mm/hugepages'), otherwise 'mmap()' fails.
+      const int shift = policy == LOAD_HUGETLB ? 21 : 30;
+      mapsz = (fsz + (1UL << shift)-1) >> shift << shift;
+      map = mmap(NULL, mapsz, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+            MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+      break;
+   }
+#endif
+   }
+
+   // Read the file in anonymous memory.
+   const int anon = policy == LOAD_COPY || policy == LOAD_HUGETLB ||
+      policy == LOAD_HUGETLB_1G;
+   if (anon && map != MAP_FAILED) {
+      size_t rs = 0;
+      while (rs < fsz) {
+         ssize_t r = pread(fd, map + rs, fsz - rs, rs);
+         if (r <= 0) break;
+         rs += r;
+      }
+      if (rs < fsz || mprotect(map, mapsz, PROT_READ) != 0) {
+         munmap(map, mapsz);
+         map = MAP_FAILED;
+      }
+   }
+
+   close(fd);
+
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "cannot load index '%s'\n", fname);
+      return -1;
+   }
+
+   // The file may have been rewritten since it was shared.
+   if (policy == LOAD_SHARED && !same_index(fname, map, fsz)) {
+      fprintf(stderr, "shared memory segment does not match file '%s'\n",
+            fname);
+      munmap(map, mapsz);
+      return -1;
+   }
+
+   if (parse_index(map, fsz, idx) != 0) {
+      munmap(map, mapsz);
+      return -1;
+   }
+
+   if (policy == LOAD_LAZY) {
+      const idxhdr_t * hdr = (const idxhdr_t *) map;
+      const sect_t occ = hdr->sect[IDX_OCC];
+      const sect_t csa = hdr->sect[IDX_CSA];
+      madvise(map + occ.offset, occ.size, MADV_RANDOM);
+      madvise(map + csa.offset, csa.size, MADV_RANDOM);
+      // The LUT is hit by every query, so start reading it.
+      const sect_t lut = hdr->sect[IDX_LUT];
+      if (lut.size > 0) madvise(map + lut.offset, lut.size, MADV_WILLNEED);
+   }
+
+   idx->map = map;
+   idx->mapsz = mapsz;
+
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   idx->loadtime = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+   idx->resident = resident_size(idx);
+
+   return 0;
+
+}
+
+
+int
+load_policy
+(
+   const char * name
+)
+// Policy of 'load_index()' with the given name, or -1.
+{
+   const char * names[] = { "populate", "lazy", "copy", "hugetlb",
+      "hugetlb1g", "shared" };
+   for (int i = 0 ; i < 6 ; i++)
+      if (strcmp(name, names[i]) == 0) return i;
+   return -1;
+}
+
+
+int
+index_shm_name
+(
+   const char   * fname,
+         char   * name,
+   const size_t   size
+)
+// Name of the shared memory segment of the index in the file
+// 'fname', made of the device and inode numbers of the file so that
+// two files with the same base name do not share a segment.
+// Return 0 on success and -1 if the file does not exist or if
+// 'name' is too small.
+{
+   struct stat st;
+   if (stat(fname, &st) != 0) return -1;
+   return snprintf(name, size, "/bwtidx-%llx-%llx",
+         (unsigned long long) st.st_dev,
+         (unsigned long long) st.st_ino) < (int) size ? 0 : -1;
+}
+
+
+int
+share_index
+(
+   const char * fname
+)
+// Copy the index in the file 'fname' to a shared memory segment,
+// that other processes attach with 'load_index()' and the policy
+// LOAD_SHARED. A previous segment is unlinked, and the processes
+// that have attached it keep it until they unload it. The header
+// is written last so that the segment is invalid until complete.
+// Return 0 on success and -1 on failure.
+{
+
+   char name[256];
+   if (index_shm_name(fname, name, sizeof(name)) != 0) return -1;
+
+   int fd = open(fname, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "cannot open file '%s'\n", fname);
+      return -1;
+   }
+   const size_t fsz = lseek(fd, 0, SEEK_END);
+
+   shm_unlink(name);
+   int shm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+   char * map = MAP_FAILED;
+   if (shm >= 0 && fsz >= sizeof(idxhdr_t) && ftruncate(shm, fsz) == 0)
+      map = mmap(NULL, fsz, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+   if (shm >= 0) close(shm);
+
+   if (map == MAP_FAILED) {
+      fprintf(stderr, "cannot create shared memory segment '%s'\n", name);
+      if (shm >= 0) shm_unlink(name);
+      close(fd);
+      return -1;
+   }
+
+#ifdef MADV_HUGEPAGE
+   madvise(map, fsz, MADV_HUGEPAGE);
+#endif
+
+   // The body first, then the header if the body is complete.
+   size_t body = sizeof(idxhdr_t);
+   while (body < fsz) {
+      ssize_t r = pread(fd, map + body, fsz - body, body);
+      if (r <= 0) break;
+      body += r;
+   }
+   ssize_t hdr = body == fsz ? pread(fd, map, sizeof(idxhdr_t), 0) : -1;
+   close(fd);
+   munmap(map, fsz);
+
+   if (body != fsz || hdr != sizeof(idxhdr_t)) {
+      fprintf(stderr, "cannot read file '%s'\n", fname);
+      shm_unlink(name);
+      return -1;
+   }
+
+   return 0;
+
+}
+
+
+int
+unshare_index
+(
+   const char * fname
+)
+// Unlink the shared memory segment of the index in the file 'fname'.
+{
+   char name[256];
+   if (index_shm_name(fname, name, sizeof(name)) != 0) return -1;
+   return shm_unlink(name);
+}
+
+
+void
+unload_index
+(
+   index_t * idx
+)
+{
+   if (idx->map != NULL) munmap(idx->map, idx->mapsz);
+   memset(idx, 0, sizeof(index_t));
+}
+
+
+size_t
+resident_size
+(
+   const index_t * idx
+)
+// Number of bytes of the loaded index that are in memory.
+{
+
+   const size_t pagesz = sysconf(_SC_PAGESIZE);
+   const size_t npages = (idx->mapsz + pagesz-1) / pagesz;
+   unsigned char * vec = malloc(npages);
+   exit_on_memory_error(vec);
+
+   size_t resident = 0;
+   if (mincore(idx->map, idx->mapsz, vec) == 0) {
+      for (size_t i = 0 ; i < npages ; i++)
+         resident += vec[i] & 1;
+   }
+
+   free(vec);
+   return resident * pagesz;
+
+}
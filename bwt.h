@@ -1,17 +1,20 @@
 #define _GNU_SOURCE
 #include <ctype.h>
+#include <endian.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-/*
-
 #ifndef _BWT_INDEX_H_
 #define _BWT_INDEX_H_
 
@@ -37,7 +40,14 @@ extern const uint8_t NONALPHABET[256];
 typedef struct blocc_t  blocc_t;
 typedef struct csa_t    csa_t;
 typedef struct bwt_t    bwt_t;
+typedef struct chr_t    chr_t;
+typedef struct index_t  index_t;
+typedef struct idxhdr_t idxhdr_t;
+typedef struct sect_t   sect_t;
+typedef struct seg_t    seg_t;
+typedef struct locus_t  locus_t;
 typedef struct lut_t    lut_t;
+typedef struct line_t   line_t;
 typedef struct occ_t    occ_t;
 typedef struct range_t  range_t;
 typedef unsigned int    uint_t;
@@ -88,13 +98,46 @@ struct range_t {
 // letters in the alphabet. Note that 'sz' is not the number of
 // 'blocc_t' in the arrays, but the size of the BWT, including the
 // termination character.
+//
+// With the layout OCC_INTERLEAVED, the 'blocc_t' of the 'SIGMA'
+// symbols for the same 32 positions are contiguous instead. They
+// occupy 32 bytes and the header occupies 128 bytes, so they are on
+// the same cache line when the table is aligned on 64 bytes.
+//
+// With the layout OCC_PACKED, 'rows' holds 'line_t' instead: each
+// line has the counts of the symbols before its first position,
+// followed by 192 positions of the BWT on 2 bits (the '$' is stored
+// as an 'A'). The counts are completed by comparing the symbols of
+// the line, so the BWT is not needed anymore and the table occupies
+// 64 bytes per 192 positions, i.e. one third of a byte per letter.
+//
+// The .smpl values (and the counts of the lines) are counts modulo
+// 2^32, so texts can be longer than 4 G characters. The true counts
+// at the start of every block of 2^OCC_SUPER_SHIFT positions (or of
+// 2^OCC_LINE_SHIFT lines) are stored on 64 bits after the entries,
+// in 'SIGMA' values per superblock. There are few of them, so they
+// stay in cache and 'get_rank()' still costs a single miss.
+#define OCC_SPLIT        0   // 'rows[c*nrows + pos/32]'.
+#define OCC_INTERLEAVED  1   // 'rows[pos/32*SIGMA + c]'.
+#define OCC_PACKED       2   // Lines of 192 positions.
+#define OCC_SUPER_SHIFT  32  // At most 32 (the size of .smpl).
+#define OCC_LINE_SHIFT   24  // Such that 192 * 2^24 < 2^32.
+
 struct occ_t {
    size_t   txtlen;      // 'strlen(txt) + 1'.
    size_t   C[SIGMA+1];  // The 'C' array.
-   size_t   nrows;       // Number of entries.
+   size_t   nrows;       // Number of entries (or lines).
+   size_t   layout;      // Order of the entries.
+   size_t   zero;        // Position of '$'.
+   size_t   pad[7];      // Align the entries on 64 bytes.
    blocc_t  rows[0];     // Occ entries.
 };
 
+struct line_t {
+   uint32_t count[SIGMA];   // Counts before the line (modulo 2^32).
+   uint64_t bwt[6];         // 192 symbols on 2 bits.
+};
+
 // The compressed suffix array.
 struct csa_t {
    size_t    nbits;      // Bits in encoding.
@@ -111,21 +154,199 @@ struct bwt_t {
    uint8_t  slots[0];    // 2-bit characters.
 };
 
-// Lookup table 
-#define LUTK 12  // Size of k-mers in the LUT.
-struct lut_t { range_t kmer[1<<(2*LUTK)]; };
+// Contigs of the genome. The text is the concatenation of the
+// contigs without their gaps (runs of symbols outside the alphabet),
+// followed by its reverse complement. The text is thus made of
+// segments, each on a single contig. 'data' holds, in order:
+//   - 'start', the start of each segment in the text, then 'gsize',
+//   - 'eytz', the starts in Eytzinger layout (from index 1),
+//   - 'rank', the index in 'start' of each entry of 'eytz',
+//   - 'segchr', the contig of each segment,
+//   - 'segoff', the position of each segment on its contig,
+//   - 'chrlen', the length of each contig (with the gaps),
+//   - 'nameoff', the offset of the name of each contig in 'names',
+//   - 'jrow', the rows of the suffixes that start at a junction,
+//     sorted (see 'find_junctions()' and 'count_hits()'),
+//   - 'names', the null-terminated names of the contigs.
+// The junctions are the starts of the segments inside the forward
+// strand, their mirrors on the reverse complement and the junction of
+// the two strands. The text joins the segments directly, so a query
+// can match across a junction although the genome has no such hit.
+struct chr_t {
+   size_t     nchr;       // Number of contigs.
+   size_t     nseg;       // Number of segments.
+   size_t     njct;       // Number of junctions.
+   size_t     gsize;      // Size of the forward strand.
+   size_t     nbytes;     // Size of 'data'.
+   uint64_t   data[0];
+};
+
+// Segment of the text without gaps.
+struct seg_t {
+   size_t   start;       // Start in the text.
+   size_t   chr;         // Index of the contig.
+   size_t   off;         // Position on the contig.
+};
+
+// Position of a hit on the genome.
+struct locus_t {
+   size_t   chr;         // Index of the contig.
+   size_t   pos;         // Position on the contig (forward strand).
+   char     strand;      // '+' or '-'.
+};
+
+// Modes of 'locate()'.
+#define LOCATE_QUERY 0   // Hits of the query.
+#define LOCATE_PAIR  1   // Hits of the query and its reverse complement.
+
+// Lookup table. The k-mers are numbered in lexicographic order
+// (the first character is in the most significant bits of the ID)
+// and 'bound' holds the first row of the range of each k-mer, on
+// 'width' bytes in little endian. The range of k-mer 'i' ends
+// before the first row of k-mer 'i+1', minus the rows of the
+// suffixes at the end of the text, that are skipped by
+// 'backward_search()'. Those rows precede the k-mers in 'tail'.
+#define LUTK 12      // Default size of k-mers in the LUT.
+#define LUT_MINK 1
+#define LUT_MAXK 15
+struct lut_t {
+   size_t   k;                // Size of the k-mers.
+   size_t   width;            // Bytes per boundary (4 or 5).
+   size_t   ntail;            // Number of suffixes at the end.
+   size_t   tail[LUT_MAXK];   // k-mers after those suffixes.
+   size_t   nbytes;           // Size of 'bound' (with padding).
+   uint8_t  bound[0];         // First rows of the k-mers.
+};
+
+// Queries advanced together by 'backward_search_batch()'.
+#define LANES 32
+
+
+
+// The index is stored in a single file, made of a header followed by
+// sections aligned on 2 MB (the size of huge pages on x86). The header
+// identifies the format, the byte order of the host that wrote it and
+// the location of the sections, and it ends with a checksum of the
+// previous bytes. Sections that are absent have size 0.
+#define IDX_MAGIC    "BWTINDEX"
+#define IDX_VERSION  5
+#define IDX_ENDIAN   0x01020304
+#define IDX_ALIGN    (1 << 21)
+
+#define IDX_BWT      0
+#define IDX_OCC      1
+#define IDX_CSA      2
+#define IDX_LUT      3
+#define IDX_CHR      4
+#define IDX_NSECT    5
+
+struct sect_t {
+   uint64_t   offset;    // Offset in the file.
+   uint64_t   size;      // Size in bytes.
+};
+
+struct idxhdr_t {
+   char       magic[8];
+   uint32_t   version;
+   uint32_t   endian;
+   uint64_t   txtlen;    // Size of the BWT.
+   uint64_t   nsect;
+   sect_t     sect[IDX_NSECT];
+   uint64_t   checksum;  // FNV-1a of the previous bytes.
+};
+
+// The parts of an index, pointing to the sections of the file.
+// The last members are set by 'load_index()'.
+struct index_t {
+   bwt_t   * bwt;
+   occ_t   * occ;
+   csa_t   * csa;
+   lut_t   * lut;        // NULL if absent.
+   chr_t   * chr;        // NULL if absent.
+   void    * map;        // Memory holding the file.
+   size_t    mapsz;      // Size of 'map'.
+   double    loadtime;   // Time to load (seconds).
+   size_t    resident;   // Bytes in memory after loading.
+};
+
+// Policies of 'load_index()'.
+#define LOAD_POPULATE    0  // Map and fault all the pages in.
+#define LOAD_LAZY        1  // Map and fault the pages in on demand.
+#define LOAD_COPY        2  // Copy to anonymous (huge page) memory.
+#define LOAD_HUGETLB     3  // Copy to reserved 2 MB pages.
+#define LOAD_HUGETLB_1G  4  // Copy to reserved 1 GB pages.
+#define LOAD_SHARED      5  // Attach the segment of 'share_index()'.
+
+
+
+// ------- Visible functions from bwt.c ------- //
+
+// Indexing functions.
+int64_t * compute_sa (const char *);
+int64_t * compute_sa_mt (const char *, int);
+int64_t * compute_sa_ext (const char *, size_t, const char *);
+csa_t   * compress_sa (int64_t *);
+bwt_t   * create_bwt (const char *, const int64_t *);
+occ_t   * create_occ (bwt_t *);
+occ_t   * create_occ_mt (bwt_t *, int);
+void      create_index (const char *, const int64_t *,
+                bwt_t **, occ_t **, csa_t **);
+void      create_index_mt (const char *, const int64_t *, int,
+                bwt_t **, occ_t **, csa_t **);
+void      create_index_direct (const char *, size_t,
+                bwt_t **, occ_t **, csa_t **);
+occ_t   * layout_occ (const occ_t *, const int);
+size_t    occ_size (const occ_t *);
+lut_t   * create_lut (const occ_t *, const bwt_t *, const size_t);
+lut_t   * create_lut_mt (const occ_t *, const bwt_t *, const size_t, int);
+void      fill_lut (lut_t *, const occ_t *, const range_t,
+                const size_t, const size_t);
+void      fill_lut_mt (lut_t *, const occ_t *, int);
+
+chr_t   * create_chr (const size_t, const size_t, const size_t *,
+                const char *, const size_t, const seg_t *);
+void      find_junctions (chr_t *, csa_t *, bwt_t *, occ_t *);
 
+// Index files.
+void      write_index (const char *, const index_t *);
+int       parse_index (const void *, const size_t, index_t *);
+int       load_index (const char *, const int, index_t *);
+int       load_policy (const char *);
+void      unload_index (index_t *);
+int       index_shm_name (const char *, char *, const size_t);
+int       share_index (const char *);
+int       unshare_index (const char *);
+size_t    resident_size (const index_t *);
 
+// Utilities.
+void      run_threads (void * (*)(void *), void *, const size_t, const int);
 
-// Visible functions from search.c.
-range_t backward_search (const char *, size_t, const occ_t *);
-size_t  query_SA (csa_t *, bwt_t *, occ_t *, size_t);
-size_t  get_rank (const occ_t *, uint8_t, size_t);
+// Query functions.
+size_t    get_rank (const occ_t *, uint8_t, size_t);
+void      get_rank_all (const occ_t *, size_t, size_t *);
+range_t   get_rank_range (const occ_t *, const uint8_t, const range_t);
+uint8_t   get_symbol (const bwt_t *, const occ_t *, size_t);
+range_t   lookup_lut (const lut_t *, const size_t);
+range_t   backward_search (const char *, const size_t, const occ_t *,
+                const lut_t *);
+void      backward_search_batch (const char * const *, const size_t *,
+                const size_t, const occ_t *, const lut_t *, range_t *);
+size_t    query_csa (csa_t *, bwt_t *, occ_t *, size_t);
+size_t    find_seg (const chr_t *, const size_t);
+int       translate_pos (const chr_t *, const size_t, const size_t,
+                locus_t *);
+size_t    locate (csa_t *, bwt_t *, occ_t *, const chr_t *, const range_t,
+                const char *, const size_t, const int, locus_t *,
+                const size_t);
+size_t    count_hits (const char *, const size_t, const range_t,
+                const occ_t *, const chr_t *);
+const char * chr_name (const chr_t *, const size_t);
+size_t    chr_len (const chr_t *, const size_t);
 
 
 // ------- Error handling macros ------- //
 
-#define exit_if_null(x) \
+#define exit_on_memory_error(x) \
    do { if ((x) == NULL) { fprintf(stderr, "memory error %s:%d:%s()\n", \
          __FILE__, __LINE__, __func__); exit(EXIT_FAILURE); }} while(0)
 
@@ -154,4 +375,3 @@ size_t  get_rank (const occ_t *, uint8_t, size_t);
   #define MMAP_FLAGS MAP_PRIVATE
 #endif
 #endif
-*/
@@ -1,202 +1,474 @@
-#define _GNU_SOURCE
-#include "divsufsort.h"
 #include "bwt.h"
+#include <sys/stat.h>
+#include <zlib.h>
+
+
+// Size of the chunks read from the fasta file.
+#define CHUNKSZ (1 << 22)
+
+// BGZF blocks decompressed per thread and per batch.
+#define BGZF_BATCH 64
+#define BGZF_MAXSZ 65536
+
+
+// State of the normalization of a fasta file. The forward sequence
+// grows from the start of 'genome' and the reverse complement grows
+// backward from its end. The gaps (runs of symbols outside the
+// alphabet) are removed and the text is split in segments.
+struct fasta_t {
+   char     * genome;
+   size_t     bufsz;
+   size_t     gsize;
+   int        header;      // Inside a header line.
+   int        inname;      // Inside a contig name.
+   int        ingap;       // Inside a gap.
+   int        implicit;    // Contig before the first header.
+   size_t     chrstart;    // Start of the contig in the text.
+   size_t     chrgap;      // Gap symbols in the contig so far.
+   size_t     nchr;        // Number of contigs.
+   size_t     chrsz;       // Size of 'chrlen'.
+   size_t   * chrlen;      // Length of the contigs.
+   size_t     nseg;        // Number of segments.
+   size_t     segsz;       // Size of 'segs'.
+   seg_t    * segs;        // Segments of the text.
+   size_t     namelen;     // Length of 'names'.
+   size_t     namesz;      // Size of 'names'.
+   char     * names;       // Null-terminated names.
+   char       fwd[256];
+   char       rev[256];
+   uint8_t    keep[256];   // 1 for the alphabet.
+   uint8_t    gap[256];    // 1 outside the alphabet and spaces.
+};
 
 
-int64_t *
-compute_suffix_array
+void
+add_name_char
 (
-   const char * txt
+   struct fasta_t * fa,
+   const char       c
 )
 {
+   if (fa->namelen >= fa->namesz) {
+      fa->namesz *= 2;
+      char * rsz = realloc(fa->names, fa->namesz);
+      exit_on_memory_error(rsz);
+      fa->names = rsz;
+   }
+   fa->names[fa->namelen++] = c;
+}
 
-   const size_t txtlen = strlen(txt) + 1;
-   int64_t *array = malloc(txtlen * sizeof(uint64_t));
-   exit_if_null(array);
 
-   divsufsort((const unsigned char *) txt, array, txtlen);
-   return array;
+void
+add_segment
+(
+   struct fasta_t * fa,
+   const size_t     start
+)
+// Start a segment at position 'start' of the text,
+// on the current contig.
+{
+   if (fa->nseg >= fa->segsz) {
+      fa->segsz *= 2;
+      seg_t * rsz = realloc(fa->segs, fa->segsz * sizeof(seg_t));
+      exit_on_memory_error(rsz);
+      fa->segs = rsz;
+   }
+   fa->segs[fa->nseg++] = (seg_t) {
+      .start = start,
+      .chr = fa->nchr - 1,
+      .off = start - fa->chrstart + fa->chrgap,
+   };
+}
+
 
+void
+close_contig
+(
+   struct fasta_t * fa
+)
+{
+   fa->chrlen[fa->nchr-1] = fa->gsize - fa->chrstart + fa->chrgap;
 }
 
 
+void
+add_contig
+(
+   struct fasta_t * fa
+)
+// Start a contig at the end of the text.
+{
+   if (fa->nchr > 0) close_contig(fa);
+   if (fa->nchr >= fa->chrsz) {
+      fa->chrsz *= 2;
+      size_t * rsz = realloc(fa->chrlen, fa->chrsz * sizeof(size_t));
+      exit_on_memory_error(rsz);
+      fa->chrlen = rsz;
+   }
+   fa->nchr++;
+   fa->chrstart = fa->gsize;
+   fa->chrgap = 0;
+   fa->ingap = 0;
+   add_segment(fa, fa->gsize);
+}
+
 
-bwt_t *
-create_bwt
+void
+init_fasta
 (
-   const char    * txt,
-   const int64_t * sa
+   struct fasta_t * fa,
+   const size_t     sizehint
 )
 {
 
-   // Allocate new 'bwt_t'.
-   const size_t txtlen = strlen(txt);
-   const size_t nslots = (txtlen + (4-1)) / 4;
-   const size_t extra = nslots * sizeof(uint8_t);
+   // Translation tables. Spaces are removed like newlines.
+   for (int c = 0 ; c < 256 ; c++) {
+      fa->keep[c] = !NONALPHABET[c];
+      fa->gap[c] = NONALPHABET[c] && !isspace(c);
+      fa->fwd[c] = toupper(c);
+      fa->rev[c] = REVCOMP[c];
+   }
+
+   fa->bufsz = 2 * (sizehint > CHUNKSZ ? sizehint : CHUNKSZ) + 1;
+   fa->gsize = 0;
+   fa->header = 0;
+   fa->genome = malloc(fa->bufsz);
+   exit_on_memory_error(fa->genome);
+
+   fa->inname = 0;
+   fa->nchr = 0;
+   fa->chrsz = 64;
+   fa->chrlen = malloc(fa->chrsz * sizeof(size_t));
+   exit_on_memory_error(fa->chrlen);
+   fa->nseg = 0;
+   fa->segsz = 64;
+   fa->segs = malloc(fa->segsz * sizeof(seg_t));
+   exit_on_memory_error(fa->segs);
+   fa->namelen = 0;
+   fa->namesz = 1024;
+   fa->names = malloc(fa->namesz);
+   exit_on_memory_error(fa->names);
+
+   // Sequence before the first header goes to a contig without
+   // a name. It is dropped at the first header if it is empty.
+   add_contig(fa);
+   add_name_char(fa, '\0');
+   fa->implicit = 1;
+
+}
 
-   bwt_t *bwt = calloc(1, sizeof(bwt_t) + extra);
-   exit_if_null(bwt);
 
-   bwt->txtlen = txtlen;
-   bwt->nslots = nslots;
+void
+add_fasta_chunk
+(
+         struct fasta_t * fa,
+   const char           * chunk,
+   const size_t           len
+)
+// Remove the headers, the newlines and the gaps of 'chunk',
+// and capitalize the letters.
+{
+
+   // Grow the buffer if needed, moving the reverse complement.
+   if (fa->bufsz < 2 * (fa->gsize + len) + 1) {
+      size_t newsz = 2 * (fa->gsize + len) + 1;
+      if (newsz < 2 * fa->bufsz) newsz = 2 * fa->bufsz;
+      char * rsz = realloc(fa->genome, newsz);
+      exit_on_memory_error(rsz);
+      memmove(rsz + newsz - fa->gsize, rsz + fa->bufsz - fa->gsize,
+            fa->gsize);
+      fa->genome = rsz;
+      fa->bufsz = newsz;
+   }
 
-   for (size_t pos = 0 ; pos < txtlen ; pos++) {
-      if (sa[pos] > 0) { 
-         uint8_t c = ENCODE[(uint8_t) txt[sa[pos]-1]];
-         bwt->slots[pos/4] |= c << 2*(pos % 4);
+   char * genome = fa->genome;
+   const size_t last = fa->bufsz - 1;
+
+   const char * p = chunk;
+   const char * end = chunk + len;
+
+   while (p < end) {
+      if (fa->header) {
+         // Copy the name (up to the first space) and
+         // skip to the end of the line.
+         const char * eol = memchr(p, '\n', end - p);
+         const char * stop = eol == NULL ? end : eol;
+         for ( ; fa->inname && p < stop ; p++) {
+            if (isspace(*p)) break;
+            add_name_char(fa, *p);
+         }
+         if (fa->inname && p < end) {
+            add_name_char(fa, '\0');
+            fa->inname = 0;
+         }
+         if (eol == NULL) break;
+         p = eol + 1;
+         fa->header = 0;
+         continue;
       }
-      else {
-         // Record the position of the zero.
-         bwt->zero = pos;
+      const char * gt = memchr(p, '>', end - p);
+      const char * stop = gt == NULL ? end : gt;
+      while (p < stop) {
+         if (fa->ingap) {
+            // Skip the gap. A segment starts at the next letter.
+            for ( ; p < stop && !fa->keep[(uint8_t) *p] ; p++)
+               fa->chrgap += fa->gap[(uint8_t) *p];
+            if (p == stop) break;
+            fa->ingap = 0;
+            add_segment(fa, fa->gsize);
+         }
+         // Newlines are written and overwritten.
+         size_t gsize = fa->gsize;
+         for ( ; p < stop ; p++) {
+            const uint8_t c = *p;
+            if (fa->gap[c]) {
+               fa->ingap = 1;
+               break;
+            }
+            genome[gsize] = fa->fwd[c];
+            genome[last - gsize] = fa->rev[c];
+            gsize += fa->keep[c];
+         }
+         fa->gsize = gsize;
+      }
+      if (gt != NULL) {
+         if (fa->implicit && fa->gsize == 0 && fa->chrgap == 0) {
+            // Drop the empty contig before the first header.
+            fa->nchr = fa->nseg = fa->namelen = 0;
+         }
+         fa->implicit = 0;
+         add_contig(fa);
+         fa->header = 1;
+         fa->inname = 1;
+         p = gt + 1;
       }
    }
 
-   return bwt;
-
 }
 
 
-void
-write_occ_blocks
+char *
+finish_fasta
 (
-   occ_t    * occ,
-   uint32_t * smpl,
-   uint32_t * bits,
-   size_t     idx    // Index of 'blocc_t' in array.
+   struct fasta_t * fa,
+   chr_t         ** chr
 )
-// Write 'SIGMA' smpl/bits blocks to the 'blocc_t' arrays of 'Occ'
-// at position 'pos' (the array index and not the position in
-// the BWT).
+// Return the sequence followed by its reverse complement,
+// and the table of the contigs in 'chr'.
 {
-   for (int i = 0 ; i < SIGMA ; i++) {
-      occ->rows[i * occ->nrows + idx].smpl = smpl[i];
-      occ->rows[i * occ->nrows + idx].bits = bits[i];
-   }
+
+   const size_t gsize = fa->gsize;
+
+   // Close the last name if the file ends in a header.
+   if (fa->inname) add_name_char(fa, '\0');
+   close_contig(fa);
+
+   *chr = create_chr(gsize, fa->nchr, fa->chrlen, fa->names,
+         fa->nseg, fa->segs);
+   free(fa->chrlen);
+   free(fa->segs);
+   free(fa->names);
+
+   // Move the reverse complement after the sequence.
+   memmove(fa->genome + gsize, fa->genome + fa->bufsz - gsize, gsize);
+   fa->genome[2*gsize] = '\0';
+
+   // Realloc buffer.
+   char * rsz = realloc(fa->genome, 2*gsize + 1);
+   exit_on_memory_error(rsz);
+
+   return rsz;
+
 }
 
 
-void
-fill_lut
+size_t
+read_full
 (
-         lut_t   * lut,
-   const occ_t   * occ,
-   const range_t   range,
-   const size_t    depth,
-   const size_t    kmerid
+   int      fd,
+   void   * buf,
+   size_t   len
 )
+// Read up to 'len' bytes, stopping early only at the end of file.
 {
-   if (depth >= LUTK) {
-      lut->kmer[kmerid] = range;
-      return;
-   }
-   for (uint8_t c = 0 ; c < SIGMA ; c++) {
-      size_t bot = get_rank(occ, c, range.bot - 1);
-      size_t top = get_rank(occ, c, range.top) - 1;
-      fill_lut(lut, occ, (range_t) { .bot=bot, .top=top },
-            depth+1, c + (kmerid << 2));
+   size_t rs = 0;
+   while (rs < len) {
+      ssize_t r = read(fd, (char *) buf + rs, len - rs);
+      exit_if(r < 0);
+      if (r == 0) break;
+      rs += r;
    }
+   return rs;
 }
 
 
-occ_t *
-create_occ
+int
+is_bgzf
 (
-   bwt_t * bwt
+   const uint8_t * head,
+   const size_t    len
 )
+// Check that 'head' starts with a gzip header with the
+// 'BC' extra subfield of the BGZF format.
 {
+   return len >= 18 && head[0] == 0x1f && head[1] == 0x8b &&
+      head[2] == 8 && (head[3] & 4) && head[12] == 'B' && head[13] == 'C';
+}
+
+
+// A BGZF block and its decompressed data.
+struct bgzf_t {
+   uint8_t    cdata[BGZF_MAXSZ];
+   size_t     clen;        // Size of the compressed data.
+   uint32_t   crc;
+   char       data[BGZF_MAXSZ];
+   size_t     len;         // Size of the decompressed data.
+};
 
-   // Allocate new 'Occ_t'.
-   const size_t txtlen = bwt->txtlen;
-   const size_t nrows = (txtlen + (32-1)) / 32;
-   const size_t extra = SIGMA*nrows * sizeof(blocc_t);
 
-   occ_t * occ = malloc(sizeof(occ_t) + extra);
-   exit_if_null(occ);
+// Arguments of the threads that decompress BGZF blocks.
+struct inflate_job_t {
+   struct bgzf_t * blocks;
+   size_t          nblocks;
+};
 
-   occ->txtlen = txtlen;
-   occ->nrows = nrows;
 
-   uint32_t smpl[SIGMA] = {0};
-   uint32_t diff[SIGMA] = {0};
-   uint32_t bits[SIGMA] = {0};
+void *
+inflate_blocks
+(
+   void * arg
+)
+{
+   struct inflate_job_t * job = arg;
+   for (size_t i = 0 ; i < job->nblocks ; i++) {
+      struct bgzf_t * blk = job->blocks + i;
+      z_stream strm = {0};
+      exit_if(inflateInit2(&strm, -15) != Z_OK);
+      strm.next_in = blk->cdata;
+      strm.avail_in = blk->clen;
+      strm.next_out = (Bytef *) blk->data;
+      strm.avail_out = BGZF_MAXSZ;
+      exit_if(inflate(&strm, Z_FINISH) != Z_STREAM_END);
+      exit_if(strm.total_out != blk->len);
+      exit_if(crc32(0, (Bytef *) blk->data, blk->len) != blk->crc);
+      inflateEnd(&strm);
+   }
+   return NULL;
+}
+
 
-   for (size_t pos = 0 ; pos < bwt->txtlen ; pos++) {
-      // Extract symbol at position 'i' from BWT.
-      uint8_t c = bwt->slots[pos/4] >> 2*(pos % 4) & 0b11;
-      if (pos != bwt->zero) {   // (Skip the '$' symbol).
-         diff[c]++;
-         bits[c] |= (1 << (31 - pos % 32));
+void
+read_bgzf
+(
+   struct fasta_t * fa,
+   int              fd,
+   const uint8_t  * head,
+   size_t           headlen,
+   const int        nthreads
+)
+// Read a BGZF file, decompressing batches of blocks on 'nthreads'
+// threads. The first 'headlen' bytes were already read in 'head'.
+{
+
+   const size_t nbatch = BGZF_BATCH * nthreads;
+   struct bgzf_t * blocks = malloc(nbatch * sizeof(struct bgzf_t));
+   exit_on_memory_error(blocks);
+
+   uint8_t hdr[18];
+   memcpy(hdr, head, headlen);
+
+   for (int eof = 0 ; !eof ; ) {
+
+      // Read a batch of blocks.
+      size_t n = 0;
+      while (n < nbatch) {
+         size_t hl = headlen + read_full(fd, hdr + headlen, 18 - headlen);
+         headlen = 0;
+         if (hl == 0) { eof = 1; break; }
+         exit_if(!is_bgzf(hdr, hl));
+         // The subfield 'BC' is the only extra field
+         // ('XLEN' is 6), as written by bgzip.
+         exit_if(hdr[10] != 6 || hdr[11] != 0);
+         const size_t bsize = (hdr[16] | hdr[17] << 8) + 1;
+         exit_if(bsize < 26);
+         struct bgzf_t * blk = blocks + n;
+         blk->clen = bsize - 26;
+         uint8_t tail[8];
+         exit_if(read_full(fd, blk->cdata, blk->clen) != blk->clen);
+         exit_if(read_full(fd, tail, 8) != 8);
+         blk->crc = tail[0] | tail[1] << 8 | tail[2] << 16 |
+            (uint32_t) tail[3] << 24;
+         blk->len = tail[4] | tail[5] << 8 | tail[6] << 16 |
+            (uint32_t) tail[7] << 24;
+         exit_if(blk->len > BGZF_MAXSZ);
+         n++;
       }
-      if (pos % 32 == 31) {     // Write every 32 entries.
-         write_occ_blocks(occ, smpl, bits, pos/32);
-         memcpy(smpl, diff, SIGMA * sizeof(uint32_t));
-         bzero(bits, sizeof(bits));
+
+      // Decompress the batch.
+      struct inflate_job_t jobs[nthreads];
+      for (int t = 0 ; t < nthreads ; t++) {
+         jobs[t].blocks = blocks + n * t / nthreads;
+         jobs[t].nblocks = n * (t+1) / nthreads - n * t / nthreads;
       }
-   }
+      run_threads(inflate_blocks, jobs, sizeof(*jobs), nthreads);
 
-   write_occ_blocks(occ, smpl, bits, (bwt->txtlen-1)/32);
+      for (size_t i = 0 ; i < n ; i++)
+         add_fasta_chunk(fa, blocks[i].data, blocks[i].len);
 
-   // Write 'nb' and 'C'.
-   occ->C[0] = 1;
-   for (int i = 1 ; i < SIGMA+1 ; i++) {
-      occ->C[i] = occ->C[i-1] + diff[i-1];
    }
 
-   return occ;
+   free(blocks);
 
 }
 
 
-
-csa_t *
-compress_sa
+void
+read_gzip
 (
-   int64_t * sa
+   struct fasta_t * fa,
+   int              fd,
+   const uint8_t  * head,
+   const size_t     headlen
 )
+// Read a gzip file, possibly made of several members (as
+// BGZF files). The first 'headlen' bytes were already read.
 {
 
-   // The first entry of the suffix array is the length of the text.
-   size_t txtlen = sa[0];
-
-   // Compute the number of required bits.
-   size_t nbits = 0;
-   while (txtlen > ((uint64_t) 1 << nbits)) nbits++;
-
-   // Compute the number of required bytes and 'uint64_t'.
-   size_t nint64 = (nbits * txtlen + (64-1)) / 64;
-   size_t extra = nint64 / 8;
-   csa_t * csa = malloc(sizeof(csa_t) + extra);
-
-   csa->nbits = nbits;
-   csa->nint64 = nint64;
-
-   // Set a mask for the 'nbits' lower bits.
-   csa->bmask = ((uint64_t) 0xFFFFFFFFFFFFFFFF) >> (64-nbits);
-   
-   uint8_t lastbit = 0;
-   size_t  nb = 0;
-
-   // Sample every 16-th value.
-   for (size_t pos = 0 ; pos < txtlen ; pos += 16) {
-      // Save the current value.
-      int64_t current = csa->bitf[pos];
-      // Store the compact version.
-      csa->bitf[nb] |= (current & csa->bmask) << lastbit;
-      // Update bit offset.
-      lastbit += nbits;
-      // Word is full.
-      if (lastbit >= 64) {
-         lastbit = lastbit - 64;
-         // Complete with remainder or set to 0 (if lastbit = 0).
-         // This will clear the upper bits of array.
-         csa->bitf[++nb] = (current & csa->bmask) >> (nbits - lastbit);
+   uint8_t * in = malloc(CHUNKSZ);
+   exit_on_memory_error(in);
+   char * out = malloc(CHUNKSZ);
+   exit_on_memory_error(out);
+
+   z_stream strm = {0};
+   exit_if(inflateInit2(&strm, 15 + 16) != Z_OK);
+
+   memcpy(in, head, headlen);
+   strm.next_in = in;
+   strm.avail_in = headlen;
+
+   int ended = 0;   // At the end of a member.
+   while (1) {
+      if (strm.avail_in == 0) {
+         strm.avail_in = read_full(fd, in, CHUNKSZ);
+         strm.next_in = in;
+         if (strm.avail_in == 0) break;
       }
+      strm.next_out = (Bytef *) out;
+      strm.avail_out = CHUNKSZ;
+      int ret = inflate(&strm, Z_NO_FLUSH);
+      exit_if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR);
+      add_fasta_chunk(fa, out, CHUNKSZ - strm.avail_out);
+      // Start the next member.
+      ended = ret == Z_STREAM_END;
+      if (ended) exit_if(inflateReset(&strm) != Z_OK);
    }
 
-   // XXX Is this really needed?
-   // nb += (lastbit > 0);
+   // The file is truncated.
+   exit_if(!ended);
 
-   return csa;
+   inflateEnd(&strm);
+   free(out);
+   free(in);
 
 }
 
@@ -204,151 +476,209 @@ compress_sa
 char *
 normalize_genome
 (
-   FILE   * inputf
+   int       fd,
+   int       nthreads,
+   chr_t  ** chr
 )
+// Read the sequences of a fasta file and return them concatenated,
+// followed by their reverse complement. Newlines and gaps (runs of
+// symbols outside the alphabet, such as 'N') are removed and the
+// letters are capitalized. The file can be plain, gzip or BGZF. BGZF files
+// are decompressed on 'nthreads' threads. The names and the
+// starts of the contigs are returned in 'chr'.
 {
 
-   // Read variables.
-   size_t sz = 64;
-   ssize_t rlen;
-   char * buffer = malloc(64);
-   exit_if_null(buffer);
-
-   // Genome storage.
-   size_t gsize = 0;
-   size_t gbufsize = 64;
-   char * genome = malloc(64); 
-   exit_if_null(genome);
-
-   // Load fasta file line by line and concatenate.
-   while ((rlen = getline(&buffer, &sz, inputf)) != -1) {
-      if (buffer[0] == '>') continue;
-      if (gbufsize < gsize + rlen) {
-         while (gbufsize < gsize + rlen) gbufsize *= 2;
-         char * rsz = realloc(genome, gbufsize);
-         exit_if_null(rsz);
-         genome = rsz;
-      }
-      int one_if_newline = (buffer[rlen-1] == '\n');
-      strncpy(genome + gsize, buffer, rlen - one_if_newline);
-      gsize += rlen - one_if_newline;
-   }
+   uint8_t head[18];
+   const size_t headlen = read_full(fd, head, sizeof(head));
+   const int gzipped = headlen >= 2 && head[0] == 0x1f && head[1] == 0x8b;
 
-   // Normalize (use only capital alphabet letters).
-   for (size_t pos = 0; pos < gsize ; pos++) {
-      int iter = 0;
-      if (NONALPHABET[(uint8_t) genome[pos]]) {
-         // Replace by cycling over (A,C,G,T).
-         genome[pos] = ALPHABET[iter++ % 4];
-      }
-      else {
-         // Use only capital letters (important for
-         // sorting the suffixes in lexicographic order).
-         genome[pos] = toupper(genome[pos]);
-      }
-   }
+   // Size the buffer from the file when possible (compressed
+   // files are assumed to expand about 4 times).
+   struct stat st;
+   size_t sizehint = 0;
+   if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+      sizehint = gzipped ? 4 * st.st_size : st.st_size;
 
-   // Realloc buffer.
-   char * rsz = realloc(genome, 2*gsize + 1);
-   exit_if_null(rsz);
-   genome = rsz;
+   struct fasta_t fa;
+   init_fasta(&fa, sizehint);
+
+   if (is_bgzf(head, headlen)) {
+      read_bgzf(&fa, fd, head, headlen, nthreads);
+   }
+   else if (gzipped) {
+      read_gzip(&fa, fd, head, headlen);
+   }
+   else {
+      char * chunk = malloc(CHUNKSZ);
+      exit_on_memory_error(chunk);
+      size_t rlen = headlen;
+      memcpy(chunk, head, headlen);
+      do {
+         add_fasta_chunk(&fa, chunk, rlen);
+      } while ((rlen = read_full(fd, chunk, CHUNKSZ)) > 0);
+      free(chunk);
+   }
 
-   // Reverse complement.
-   size_t div = gsize;
-   for (size_t pos = 0 ; pos < div ; pos++)
-      genome[div + pos] = REVCOMP[(uint8_t) genome[div-pos-1]];
+   return finish_fasta(&fa, chr);
 
-   gsize = 2*gsize + 1;
+}
 
-   // Add the terminator.
-   genome[2*div] = '\0';
 
-   // Clean up.
-   free(buffer);
+void
+say_usage
+(void)
+{
+   fprintf(stderr, "usage: index [-t threads] [-k lut k-mer size] "
+         "[-m memory [-d tmpdir | -b]] [-o split|interleaved|packed] "
+         "genome.fasta[.gz]\n");
+}
 
-   return genome;
 
+size_t
+parse_size
+(
+   const char * str
+)
+// Parse a size in bytes with an optional K, M or G suffix.
+{
+   char * end;
+   size_t sz = strtoull(str, &end, 10);
+   switch (toupper(*end)) {
+      case 'G': sz <<= 10;
+         // fall through
+      case 'M': sz <<= 10;
+         // fall through
+      case 'K': sz <<= 10;
+   }
+   return sz;
 }
 
 
 int main(int argc, char ** argv) {
 
+   // Parse options.
+   int nthreads = 1;
+   size_t budget = 0;       // Memory for the suffix array (0: no limit).
+   char * tmpdir = ".";
+   int direct = 0;          // Build the BWT without the suffix array.
+   int k = LUTK;            // Size of the k-mers in the lookup table.
+   int layout = OCC_SPLIT;  // Layout of the Occ table.
+   int opt;
+
+   while ((opt = getopt(argc, argv, "t:k:m:d:bo:")) != -1) {
+      switch (opt) {
+      case 't':
+         nthreads = atoi(optarg);
+         break;
+      case 'k':
+         k = atoi(optarg);
+         break;
+      case 'm':
+         budget = parse_size(optarg);
+         break;
+      case 'd':
+         tmpdir = optarg;
+         break;
+      case 'b':
+         direct = 1;
+         break;
+      case 'o':
+         layout = strcmp(optarg, "split") == 0 ? OCC_SPLIT :
+            strcmp(optarg, "interleaved") == 0 ? OCC_INTERLEAVED :
+            strcmp(optarg, "packed") == 0 ? OCC_PACKED : -1;
+         break;
+      default:
+         say_usage();
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (argc - optind != 1) {
+      say_usage();
+      exit(EXIT_FAILURE);
+   }
+
+   const char * fname = argv[optind];
+
    // Sanity checks.
-   exit_if(argc != 2);
-   exit_if(strlen(argv[1]) > 250);
+   exit_if(nthreads < 1);
+   exit_if(k < LUT_MINK || k > LUT_MAXK);
+   exit_if(layout < 0);
+   exit_if(strlen(fname) > 250);
+   exit_if(strlen(tmpdir) > 240);
 
    // Open fasta file.
-   FILE * fasta = fopen(argv[1], "r");
-   if (fasta == NULL) exit_cannot_open(argv[1]);
+   int fasta = open(fname, O_RDONLY);
+   if (fasta < 0) exit_cannot_open(fname);
 
    // Read and normalize genome
    fprintf(stderr, "reading genome... ");
-   char * genome = normalize_genome(fasta);
+   chr_t * chr;
+   char * genome = normalize_genome(fasta, nthreads, &chr);
+   close(fasta);
    fprintf(stderr, "done\n");
 
-   fprintf(stderr, "creating suffix array... ");
-   int64_t * sa = compute_suffix_array(genome);
-   fprintf(stderr, "done\n");
+   bwt_t * bwt;
+   occ_t * occ;
+   csa_t * csa;
 
-   fprintf(stderr, "creating BWT... ");
-   bwt_t * bwt = create_bwt(genome, sa);
-   fprintf(stderr, "done\n");
+   if (direct) {
+      // Without a budget, use about 1 byte per character.
+      if (budget == 0) budget = strlen(genome) + 1;
+      fprintf(stderr, "creating BWT, Occ table and SA samples by blocks... ");
+      create_index_direct(genome, budget, &bwt, &occ, &csa);
+      fprintf(stderr, "done\n");
+   }
+   else {
+      fprintf(stderr, "creating suffix array... ");
+      // With a memory budget, the suffix array is sorted by blocks
+      // and mapped from a scratch file in 'tmpdir'.
+      int64_t * sa = budget > 0 ?
+         compute_sa_ext(genome, budget, tmpdir) :
+         compute_sa_mt(genome, nthreads);
+      fprintf(stderr, "done\n");
+
+      fprintf(stderr, "creating BWT, Occ table and SA samples... ");
+      create_index_mt(genome, sa, nthreads, &bwt, &occ, &csa);
+      fprintf(stderr, "done\n");
+
+      if (budget > 0) munmap(sa, (sa[0]+1) * sizeof(int64_t));
+      else            free(sa);
+   }
 
-   fprintf(stderr, "creating Occ table... ");
-   occ_t * occ = create_occ(bwt);
-   fprintf(stderr, "done\n");
+   // The text is not needed anymore.
+   free(genome);
+
+   // The Occ table is built in the layout OCC_SPLIT.
+   if (layout != OCC_SPLIT) {
+      occ_t * copy = layout_occ(occ, layout);
+      free(occ);
+      occ = copy;
+   }
 
    fprintf(stderr, "filling lookup table... ");
-   lut_t * lut = malloc(sizeof(lut_t));
-   fill_lut(lut, occ, (range_t) {.bot=1, .top=strlen(genome)}, 0, 0);
+   lut_t * lut = create_lut_mt(occ, bwt, k, nthreads);
    fprintf(stderr, "done\n");
 
-   fprintf(stderr, "compressing suffix array... ");
-   csa_t * csa = compress_sa(sa);
+   // Queries can match across the junctions of the segments,
+   // 'count_hits()' needs their rows to discount such hits.
+   fprintf(stderr, "finding junctions... ");
+   find_junctions(chr, csa, bwt, occ);
    fprintf(stderr, "done\n");
 
-   // Write files
+   // Write the index.
    char buff[256];
-   char * data;
-   ssize_t ws;
-   size_t sz;
-
-   // Write the suffix array file.
-   sprintf(buff, "%s.sa", argv[1]);
-   int fsar = creat(buff, 0644);
-   if (fsar < 0) exit_cannot_open(buff);
-   
-   ws = 0;
-   sz = sizeof(csa_t) + csa->nint64 * sizeof(int64_t);
-   data = (char *) csa;
-   while (ws < sz) ws += write(fsar, data + ws, sz - ws);
-   close(fsar);
-
-
-   // Write the Burrows-Wheeler transform.
-   sprintf(buff, "%s.bwt", argv[1]);
-   int fbwt = creat(buff, 0644);
-   if (fbwt < 0) exit_cannot_open(buff);
-
-   ws = 0;
-   sz = sizeof(bwt_t) + bwt->nslots * sizeof(uint8_t);
-   data = (char *) bwt;
-   while (ws < sz) ws += write(fbwt, data + ws, sz - ws);
-   close(fbwt);
-
-
-   // Write the Burrows-Wheeler transform.
-   sprintf(buff, "%s.occ", argv[1]);
-   int focc = creat(buff, 0644);
-   if (focc < 0) exit_cannot_open(buff);
-
-   ws = 0;
-   sz = sizeof(occ_t) + occ->nrows * SIGMA * sizeof(blocc_t);
-   data = (char *) occ;
-   while (ws < sz) ws += write(focc, data + ws, sz - ws);
-   close(focc);
+   sprintf(buff, "%s.idx", fname);
+   // With the layout OCC_PACKED, the BWT is in the Occ table
+   // and only the header of the BWT is written.
+   bwt_t header = *bwt;
+   if (layout == OCC_PACKED) header.nslots = 0;
+   write_index(buff, &(index_t) {
+      .bwt = layout == OCC_PACKED ? &header : bwt,
+      .occ = occ, .csa = csa, .lut = lut, .chr = chr });
 
    // Clean up.
+   free(chr);
    free(csa);
    free(bwt);
    free(occ);
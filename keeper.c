@@ -0,0 +1,46 @@
+#include "bwt.h"
+#include <signal.h>
+
+// Keep an index in shared memory for the lifetime of the process.
+// The processes started in the meantime attach it with the load
+// policy LOAD_SHARED (e.g. 'seed -l shared') instead of reading the
+// file. The segment is removed on SIGINT, SIGTERM or SIGHUP.
+
+int main(int argc, char ** argv) {
+
+   // Sanity checks.
+   if (argc != 2) {
+      fprintf(stderr, "usage: keeper genome.fasta[.gz]\n");
+      exit(EXIT_FAILURE);
+   }
+   exit_if(strlen(argv[1]) > 250);
+
+   // Block the signals before sharing, so that they are
+   // not lost between 'share_index()' and 'sigwait()'.
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set, SIGINT);
+   sigaddset(&set, SIGTERM);
+   sigaddset(&set, SIGHUP);
+   exit_if(sigprocmask(SIG_BLOCK, &set, NULL) != 0);
+
+   char buff[256];
+   sprintf(buff, "%s.idx", argv[1]);
+   exit_if(share_index(buff) != 0);
+
+   // Check that the segment is valid.
+   index_t idx;
+   exit_if(load_index(buff, LOAD_SHARED, &idx) != 0);
+   char name[256];
+   index_shm_name(buff, name, sizeof(name));
+   fprintf(stderr, "index shared as '%s' (%zu MB)\n", name,
+         idx.mapsz >> 20);
+   unload_index(&idx);
+
+   int sig;
+   sigwait(&set, &sig);
+
+   unshare_index(buff);
+   fprintf(stderr, "index unshared\n");
+
+}
@@ -3,49 +3,60 @@
 int main(int argc, char ** argv) {
 
    // Sanity checks.
-   exit_if(argc != 2);
-   exit_if(strlen(argv[1]) > 250);
-
-   // Load index files.
-   BWT_t  * BWT;
-   Occ_t  * Occ;
-   SA_t   * SA;
-
-   size_t mmsz;
+   char * usage = "usage: seed [-l populate|lazy|copy|hugetlb|hugetlb1g"
+      "|shared] genome.fasta [query]";
+   int policy = LOAD_POPULATE;
+   int opt;
+   while ((opt = getopt(argc, argv, "l:")) != -1) {
+      if (opt != 'l' || (policy = load_policy(optarg)) < 0) {
+         fprintf(stderr, "%s\n", usage);
+         exit(EXIT_FAILURE);
+      }
+   }
+   if (argc - optind != 1 && argc - optind != 2) {
+      fprintf(stderr, "%s\n", usage);
+      exit(EXIT_FAILURE);
+   }
+   exit_if(strlen(argv[optind]) > 250);
+
+   // Load index.
    char buff[256];
-
-   sprintf(buff, "%s.sa", argv[1]);
-   int fsar = open(buff, O_RDONLY);
-   if (fsar < 0) exit_cannot_open(buff);
-
-   mmsz = lseek(fsar, 0, SEEK_END);
-   SA = (SA_t *) mmap(NULL, mmsz, PROT_READ, MMAP_FLAGS, fsar, 0);
-   exit_if(SA == NULL);
-   close(fsar);
-
-
-   sprintf(buff, "%s.bwt", argv[1]);
-   int fbwt = open(buff, O_RDONLY);
-   if (fbwt < 0) exit_cannot_open(buff);
-
-   mmsz = lseek(fbwt, 0, SEEK_END);
-   BWT = (BWT_t *) mmap(NULL, mmsz, PROT_READ, MMAP_FLAGS, fbwt, 0);
-   exit_if(BWT == NULL);
-   close(fbwt);
-
-
-   sprintf(buff, "%s.occ", argv[1]);
-   int focc = open(buff, O_RDONLY);
-   if (focc < 0) exit_cannot_open(buff);
-
-   mmsz = lseek(focc, 0, SEEK_END);
-   Occ = (Occ_t *) mmap(NULL, mmsz, PROT_READ, MMAP_FLAGS, focc, 0);
-   exit_if(Occ == NULL);
-   close(focc);
+   sprintf(buff, "%s.idx", argv[optind]);
+   index_t idx;
+   exit_if(load_index(buff, policy, &idx) != 0);
+   fprintf(stderr, "loaded index in %.3f s (%zu MB resident)\n",
+         idx.loadtime, idx.resident >> 20);
+
+   bwt_t  * BWT = idx.bwt;
+   occ_t  * Occ = idx.occ;
+   csa_t  * SA = idx.csa;
+   lut_t  * LUT = idx.lut;
+   chr_t  * CHR = idx.chr;
 
    // Make all 12-mers.
-   //range_t range = backward_search("ATGCTGATGTGATGTGCTGAGA", 12, Occ);
-      range_t range = backward_search("AATCAAAAAAAA", 11, Occ);
-      fprintf(stdout, "%ld, %ld\n", range.bot, range.top);
+   //range_t range = backward_search("ATGCTGATGTGATGTGCTGAGA", 12, Occ, LUT);
+   // The query can be passed as second argument.
+   const char * query = argc - optind == 2 ? argv[optind+1] : "AATCAAAAAAA";
+   const size_t len = strlen(query);
+      range_t range = backward_search(query, len, Occ, LUT);
+      // The range includes the hits across junctions, the count not.
+      fprintf(stdout, "%ld, %ld (%zu hits)\n", range.bot, range.top,
+            count_hits(query, len, range, Occ, CHR));
+
+   // Print the positions of the hits on the contigs,
+   // skipping those that straddle a junction.
+   if (CHR != NULL && range.top >= range.bot) {
+      const size_t max = range.top - range.bot + 1;
+      locus_t * loci = malloc(max * sizeof(locus_t));
+      exit_on_memory_error(loci);
+      size_t n = locate(SA, BWT, Occ, CHR, range, query, len, LOCATE_QUERY,
+            loci, max);
+      for (size_t i = 0 ; i < n ; i++)
+         fprintf(stdout, "%s:%zu:%c\n", chr_name(CHR, loci[i].chr),
+               loci[i].pos + 1, loci[i].strand);
+      free(loci);
+   }
+
+   unload_index(&idx);
 
 }
@@ -0,0 +1,473 @@
+#include "bwt.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Query server. The index is loaded once and queries are received
+// on a Unix domain socket, one per line:
+//
+//   range ACGT...     ->  ACGT...<TAB>bot<TAB>top<TAB>n
+//   locate ACGT...    ->  ACGT...<TAB>n<TAB>chr:pos:strand ...
+//
+// The range may contain hits that straddle a junction of the text
+// (see 'chr_t'), 'n' is the number of hits without them.
+// The answers are sent in the order of the queries. All the lines
+// received at once on a connection form a batch. The queries of all
+// the connections go to a single queue, where a pool of worker
+// threads takes them by slices, so that the queries of many light
+// clients are searched together, and clients can stream millions of
+// queries without paying the startup of a process.
+
+#define SLICE 64               // Queries per job of the workers.
+#define BUFSZ (1 << 16)        // Initial size of the read buffer.
+#define READSZ (1 << 20)       // Longest request line.
+
+struct batch_t {
+   char            ** line;    // Queries (modified in place).
+   char            ** answer;  // Answers (allocated by the workers).
+   size_t             n;       // Number of queries.
+   size_t             size;    // Capacity of 'line' and 'answer'.
+   size_t             pending; // Queries not yet answered.
+   pthread_mutex_t    lock;
+   pthread_cond_t     done;
+};
+
+struct query_t {
+   struct batch_t   * batch;
+   size_t             id;      // Index of the query in the batch.
+};
+
+// Queue of queries, shared by the connections and the workers.
+static struct {
+   struct query_t   * queries;
+   size_t             size;    // Capacity.
+   size_t             head;
+   size_t             count;
+   pthread_mutex_t    lock;
+   pthread_cond_t     nonempty;
+   pthread_cond_t     nonfull;
+} QUEUE = {
+   .lock = PTHREAD_MUTEX_INITIALIZER,
+   .nonempty = PTHREAD_COND_INITIALIZER,
+   .nonfull = PTHREAD_COND_INITIALIZER,
+};
+
+static index_t   IDX;
+static size_t    MAXHITS = 1000;   // Loci per answer at most.
+static char    * SOCKPATH;
+
+
+void
+say_usage
+(void)
+{
+   fprintf(stderr, "usage: server [-t threads] [-l policy] [-s socket] "
+         "[-m max hits] genome.fasta[.gz]\n");
+}
+
+
+void
+push_batch
+(
+   struct batch_t * batch
+)
+// Queue the queries of 'batch', waiting for room if needed.
+{
+   pthread_mutex_lock(&QUEUE.lock);
+   for (size_t i = 0 ; i < batch->n ; i++) {
+      while (QUEUE.count == QUEUE.size)
+         pthread_cond_wait(&QUEUE.nonfull, &QUEUE.lock);
+      QUEUE.queries[(QUEUE.head + QUEUE.count++) % QUEUE.size] =
+         (struct query_t) { batch, i };
+      pthread_cond_signal(&QUEUE.nonempty);
+   }
+   pthread_mutex_unlock(&QUEUE.lock);
+}
+
+
+size_t
+pop_slice
+(
+   struct query_t * slice
+)
+// Take up to 'SLICE' queries from the queue, from any connection,
+// waiting for one if the queue is empty. Return their number.
+{
+   pthread_mutex_lock(&QUEUE.lock);
+   while (QUEUE.count == 0)
+      pthread_cond_wait(&QUEUE.nonempty, &QUEUE.lock);
+   size_t n = QUEUE.count < SLICE ? QUEUE.count : SLICE;
+   for (size_t i = 0 ; i < n ; i++)
+      slice[i] = QUEUE.queries[(QUEUE.head + i) % QUEUE.size];
+   QUEUE.head = (QUEUE.head + n) % QUEUE.size;
+   QUEUE.count -= n;
+   // Other workers take the rest.
+   if (QUEUE.count > 0) pthread_cond_signal(&QUEUE.nonempty);
+   pthread_cond_broadcast(&QUEUE.nonfull);
+   pthread_mutex_unlock(&QUEUE.lock);
+   return n;
+}
+
+
+char *
+parse_request
+(
+   char * line,
+   int  * loc
+)
+// Return the query of the request in 'line' (NULL if the request
+// is unknown) and set 'loc' if the loci are requested.
+{
+   *loc = strncmp(line, "locate ", 7) == 0;
+   if (*loc) return line + 7;
+   if (strncmp(line, "range ", 6) == 0) return line + 6;
+   return NULL;
+}
+
+
+char *
+answer_query
+(
+   char          * line,
+   const range_t   range,
+   locus_t       * loci
+)
+// Answer the request in 'line', whose query has the given range.
+{
+
+   char * answer = NULL;
+   size_t size = 0;
+   FILE * out = open_memstream(&answer, &size);
+   exit_on_memory_error(out);
+
+   int loc;
+   char * query = parse_request(line, &loc);
+
+   if (query == NULL) {
+      fprintf(out, "error\tunknown request\n");
+   }
+   else if (!loc) {
+      fprintf(out, "%s\t%zu\t%zu\t%zu\n", query, range.bot, range.top,
+            count_hits(query, strlen(query), range, IDX.occ, IDX.chr));
+   }
+   else if (IDX.chr == NULL) {
+      fprintf(out, "error\tno contigs in the index\n");
+   }
+   else {
+      size_t n = range.top >= range.bot ?
+         locate(IDX.csa, IDX.bwt, IDX.occ, IDX.chr, range, query,
+               strlen(query), LOCATE_QUERY, loci, MAXHITS) : 0;
+      fprintf(out, "%s\t%zu\t", query, n);
+      for (size_t i = 0 ; i < n ; i++)
+         fprintf(out, "%s%s:%zu:%c", i ? " " : "",
+               chr_name(IDX.chr, loci[i].chr), loci[i].pos + 1,
+               loci[i].strand);
+      fprintf(out, "\n");
+   }
+
+   fclose(out);
+   return answer;
+
+}
+
+
+void *
+work
+(
+   void * arg
+)
+// Worker thread: process the slices of the queue. The queries
+// of a slice are searched together.
+{
+
+   (void) arg;
+   locus_t * loci = malloc(MAXHITS * sizeof(locus_t));
+   exit_on_memory_error(loci);
+
+   struct query_t slice[SLICE];
+   const char * query[SLICE];
+   size_t len[SLICE];
+   range_t range[SLICE];
+
+   while (1) {
+      const size_t n = pop_slice(slice);
+      for (size_t i = 0 ; i < n ; i++) {
+         int loc;
+         query[i] = parse_request(slice[i].batch->line[slice[i].id], &loc);
+         if (query[i] == NULL) query[i] = "";
+         len[i] = strlen(query[i]);
+      }
+      backward_search_batch(query, len, n, IDX.occ, IDX.lut, range);
+      for (size_t i = 0 ; i < n ; i++) {
+         struct batch_t * batch = slice[i].batch;
+         batch->answer[slice[i].id] =
+            answer_query(batch->line[slice[i].id], range[i], loci);
+      }
+      // The queries of a connection come in runs in the slice.
+      for (size_t i = 0 ; i < n ; ) {
+         struct batch_t * batch = slice[i].batch;
+         size_t done = 0;
+         for ( ; i < n && slice[i].batch == batch ; i++) done++;
+         pthread_mutex_lock(&batch->lock);
+         batch->pending -= done;
+         if (batch->pending == 0) pthread_cond_signal(&batch->done);
+         pthread_mutex_unlock(&batch->lock);
+      }
+   }
+
+   return NULL;
+
+}
+
+
+int
+send_all
+(
+   int          fd,
+   const char * data,
+   size_t       len
+)
+{
+   while (len > 0) {
+      ssize_t w = send(fd, data, len, MSG_NOSIGNAL);
+      if (w <= 0) return -1;
+      data += w;
+      len -= w;
+   }
+   return 0;
+}
+
+
+void *
+serve
+(
+   void * arg
+)
+// Connection thread: read the queries, dispatch them to the
+// workers by batches and send the answers.
+{
+
+   const int fd = (int) (intptr_t) arg;
+
+   // The buffer grows for long lines, up to 'READSZ'.
+   size_t bufsz = BUFSZ;
+   char * buff = malloc(bufsz);
+   exit_on_memory_error(buff);
+   size_t used = 0;
+
+   struct batch_t batch = {
+      .size = 64,
+      .lock = PTHREAD_MUTEX_INITIALIZER,
+      .done = PTHREAD_COND_INITIALIZER,
+   };
+   batch.line = malloc(batch.size * sizeof(char *));
+   batch.answer = malloc(batch.size * sizeof(char *));
+   exit_on_memory_error(batch.line);
+   exit_on_memory_error(batch.answer);
+
+   int skip = 0;   // Inside a line that is too long.
+   ssize_t r;
+   while ((r = read(fd, buff + used, bufsz - used)) > 0) {
+
+      used += r;
+      char * start = buff;
+
+      // Drop the rest of a line that is too long.
+      if (skip) {
+         char * eol = memchr(buff, '\n', used);
+         if (eol == NULL) {
+            used = 0;
+            continue;
+         }
+         start = eol + 1;
+         skip = 0;
+      }
+
+      // Cut the complete lines.
+      batch.n = 0;
+      char * end;
+      while ((end = memchr(start, '\n', buff + used - start)) != NULL) {
+         *end = '\0';
+         if (end > start && end[-1] == '\r') end[-1] = '\0';
+         // Empty lines are skipped.
+         if (*start != '\0') {
+            if (batch.n == batch.size) {
+               batch.size *= 2;
+               char ** line = realloc(batch.line,
+                     batch.size * sizeof(char *));
+               exit_on_memory_error(line);
+               batch.line = line;
+               char ** answer = realloc(batch.answer,
+                     batch.size * sizeof(char *));
+               exit_on_memory_error(answer);
+               batch.answer = answer;
+            }
+            batch.line[batch.n++] = start;
+         }
+         start = end + 1;
+      }
+
+      if (batch.n > 0) {
+         batch.pending = batch.n;
+         push_batch(&batch);
+         pthread_mutex_lock(&batch.lock);
+         while (batch.pending > 0)
+            pthread_cond_wait(&batch.done, &batch.lock);
+         pthread_mutex_unlock(&batch.lock);
+
+         // Send the answers in as few calls as possible.
+         char * out = NULL;
+         size_t outsz = 0;
+         FILE * stream = open_memstream(&out, &outsz);
+         exit_on_memory_error(stream);
+         for (size_t i = 0 ; i < batch.n ; i++) {
+            fputs(batch.answer[i], stream);
+            free(batch.answer[i]);
+         }
+         fclose(stream);
+         int failed = send_all(fd, out, outsz);
+         free(out);
+         if (failed) break;
+      }
+
+      // Keep the incomplete line.
+      used = buff + used - start;
+      memmove(buff, start, used);
+
+      // Grow the buffer for a long line. A line longer than
+      // 'READSZ' cannot be answered.
+      if (used == bufsz && bufsz < READSZ) {
+         bufsz *= 2;
+         char * rsz = realloc(buff, bufsz);
+         exit_on_memory_error(rsz);
+         buff = rsz;
+      }
+      else if (used == bufsz) {
+         const char error[] = "error\tline too long\n";
+         if (send_all(fd, error, sizeof(error) - 1)) break;
+         used = 0;
+         skip = 1;
+      }
+
+   }
+
+   close(fd);
+   free(batch.line);
+   free(batch.answer);
+   free(buff);
+   return NULL;
+
+}
+
+
+void *
+wait_signal
+(
+   void * arg
+)
+// Remove the socket and exit on SIGINT, SIGTERM or SIGHUP.
+{
+   int sig;
+   sigwait((sigset_t *) arg, &sig);
+   unlink(SOCKPATH);
+   fprintf(stderr, "server stopped\n");
+   exit(EXIT_SUCCESS);
+}
+
+
+int main(int argc, char ** argv) {
+
+   int nthreads = 1;
+   int policy = LOAD_POPULATE;
+   char * sockpath = NULL;
+   long maxhits = MAXHITS;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "t:l:s:m:")) != -1) {
+      switch (opt) {
+      case 't':
+         nthreads = atoi(optarg);
+         break;
+      case 'l':
+         policy = load_policy(optarg);
+         break;
+      case 's':
+         sockpath = optarg;
+         break;
+      case 'm':
+         maxhits = strtol(optarg, NULL, 10);
+         break;
+      default:
+         say_usage();
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (argc - optind != 1) {
+      say_usage();
+      exit(EXIT_FAILURE);
+   }
+
+   const char * fname = argv[optind];
+
+   // Sanity checks.
+   exit_if(nthreads < 1);
+   exit_if(policy < 0);
+   // The buffer of the loci must not overflow.
+   exit_if(maxhits < 1 || maxhits > (1L << 30));
+   MAXHITS = maxhits;
+   exit_if(strlen(fname) > 250);
+
+   // Load index.
+   char buff[256];
+   sprintf(buff, "%s.idx", fname);
+   exit_if(load_index(buff, policy, &IDX) != 0);
+   fprintf(stderr, "loaded index in %.3f s (%zu MB resident)\n",
+         IDX.loadtime, IDX.resident >> 20);
+
+   // The socket is next to the index by default.
+   char defpath[256];
+   sprintf(defpath, "%s.sock", fname);
+   SOCKPATH = sockpath != NULL ? sockpath : defpath;
+
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   exit_if(strlen(SOCKPATH) >= sizeof(addr.sun_path));
+   strcpy(addr.sun_path, SOCKPATH);
+
+   int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   exit_if(sock < 0);
+   unlink(SOCKPATH);
+   exit_if(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0);
+   exit_if(listen(sock, 64) != 0);
+
+   // The signals are handled by a dedicated thread.
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set, SIGINT);
+   sigaddset(&set, SIGTERM);
+   sigaddset(&set, SIGHUP);
+   exit_if(pthread_sigmask(SIG_BLOCK, &set, NULL) != 0);
+
+   pthread_t tid;
+   exit_if(pthread_create(&tid, NULL, wait_signal, &set) != 0);
+
+   // Start the workers.
+   QUEUE.size = 4 * SLICE * nthreads;
+   QUEUE.queries = malloc(QUEUE.size * sizeof(struct query_t));
+   exit_on_memory_error(QUEUE.queries);
+   for (int t = 0 ; t < nthreads ; t++)
+      exit_if(pthread_create(&tid, NULL, work, NULL) != 0);
+
+   fprintf(stderr, "listening on '%s'\n", SOCKPATH);
+
+   while (1) {
+      int fd = accept(sock, NULL, NULL);
+      if (fd < 0) continue;
+      if (pthread_create(&tid, NULL, serve, (void *) (intptr_t) fd) != 0) {
+         close(fd);
+         continue;
+      }
+      pthread_detach(tid);
+   }
+
+}
@@ -1,5 +1,47 @@
-#include "unittest.h"
 #include "bwt.c"
+#include "unittest.h"
+
+
+char *
+random_text
+(
+   const size_t len
+)
+// Random text of 'len' nucleotides, the same for a given length.
+// Return NULL if the memory cannot be allocated.
+{
+   char *txt = malloc(len + 1);
+   if (txt == NULL) return NULL;
+   srand(123);
+   for (size_t i = 0 ; i < len ; i++)
+      txt[i] = ALPHABET[rand() % 4];
+   txt[len] = '\0';
+   return txt;
+}
+
+
+char *
+random_genome
+(
+   const size_t gsize
+)
+// Random text of 'gsize' nucleotides followed by its reverse
+// complement, as in an index. Return NULL on memory error.
+{
+   char *txt = random_text(gsize);
+   if (txt == NULL) return NULL;
+   char *rsz = realloc(txt, 2*gsize + 1);
+   if (rsz == NULL) {
+      free(txt);
+      return NULL;
+   }
+   txt = rsz;
+   for (size_t i = 0 ; i < gsize ; i++)
+      txt[2*gsize-i-1] = REVCOMP[(uint8_t) txt[i]];
+   txt[2*gsize] = '\0';
+   return txt;
+}
+
 
 void
 test_compute_sa
@@ -21,6 +63,125 @@ test_compute_sa
 }
 
 
+void
+test_compute_sa_mt
+(void)
+{
+
+   // Random text with a repeated block and a tandem repeat, both
+   // longer than the period of the difference cover, so that the
+   // ranks of the cover need several rounds of prefix doubling.
+   const size_t len = 100000;
+   char *txt = random_text(len);
+   test_assert_critical(txt != NULL);
+   memcpy(txt + len/2, txt, len/4);
+   for (size_t i = len/4 ; i < len/4 + 20000 ; i++)
+      txt[i] = txt[i-171];
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+
+   for (int nthreads = 2 ; nthreads <= 8 ; nthreads *= 2) {
+      int64_t *SAmt = compute_sa_mt(txt, nthreads);
+      test_assert_critical(SAmt != NULL);
+      test_assert(memcmp(SA, SAmt, (len+1) * sizeof(int64_t)) == 0);
+      free(SAmt);
+   }
+
+   free(SA);
+   free(txt);
+
+}
+
+
+void
+test_compute_sa_ext
+(void)
+{
+
+   // Random text with a repeated block longer than the period
+   // of the difference cover, so that ties are broken by ranks.
+   const size_t len = 50000;
+   char *txt = random_text(len);
+   test_assert_critical(txt != NULL);
+   memcpy(txt + len/2, txt, 5000);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+
+   // The budget allows about 20000 suffixes per block.
+   int64_t *SAext = compute_sa_ext(txt, 160000, ".");
+   test_assert_critical(SAext != NULL);
+   test_assert(memcmp(SA, SAext, (len+1) * sizeof(int64_t)) == 0);
+
+   munmap(SAext, (len+1) * sizeof(int64_t));
+   free(SA);
+   free(txt);
+
+}
+
+
+// Largest block passed to 'copy_block()'.
+static size_t MAXBLOCK;
+
+void
+copy_block
+(
+   const int64_t * blk,
+   const size_t    n,
+   const size_t    from,
+         void    * data
+)
+// Callback of 'sort_blocks()' that copies the blocks to the
+// array 'data' (the next row is stored after the suffixes).
+{
+   int64_t *sa = data;
+   if (n > MAXBLOCK) MAXBLOCK = n;
+   if ((size_t) sa[-1] == from) memcpy(sa + from, blk, n * sizeof(int64_t));
+   sa[-1] = from + n;
+}
+
+
+void
+test_sort_blocks
+(void)
+{
+
+   // Low-complexity text: a run of 'A' and a run of 'AC' make
+   // buckets larger than the budget, that no prefix of 'SORTK'
+   // characters splits.
+   const size_t len = 24000;
+   char *txt = random_text(len);
+   test_assert_critical(txt != NULL);
+   memset(txt, 'A', 8000);
+   for (size_t i = 8000 ; i < 16000 ; i++)
+      txt[i] = "AC"[i % 2];
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+
+   int64_t *SAblk = calloc(len + 2, sizeof(int64_t));
+   test_assert_critical(SAblk != NULL);
+
+   // The smallest budget ('MINBLK' suffixes).
+   MAXBLOCK = 0;
+   sort_blocks(txt, 0, copy_block, SAblk + 1);
+   test_assert(SAblk[0] == len + 1);
+   test_assert(MAXBLOCK <= MINBLK);
+   test_assert(memcmp(SA, SAblk + 1, (len+1) * sizeof(int64_t)) == 0);
+
+   int64_t *SAext = compute_sa_ext(txt, 0, ".");
+   test_assert_critical(SAext != NULL);
+   test_assert(memcmp(SA, SAext, (len+1) * sizeof(int64_t)) == 0);
+
+   munmap(SAext, (len+1) * sizeof(int64_t));
+   free(SAblk);
+   free(SA);
+   free(txt);
+
+}
+
+
 void
 test_compress_sa
 (void)
@@ -123,6 +284,45 @@ test_write_occ_blocks
 }
 
 
+void
+test_occ_word
+(void)
+{
+
+   void (*kernel)(uint64_t, uint32_t, uint32_t *, uint32_t *) =
+      occ_word_kernel();
+
+   srand(123);
+   for (int iter = 0 ; iter < 1000 ; iter++) {
+      uint64_t w = (uint64_t) rand() << 42 ^ (uint64_t) rand() << 21 ^ rand();
+      uint32_t mask = rand() ^ rand() << 16;
+
+      // Set the bits one position at a time.
+      uint32_t expected[SIGMA] = {0};
+      for (int pos = 0 ; pos < 32 ; pos++) {
+         uint8_t c = w >> 2*pos & 0b11;
+         expected[c] |= (1U << (31 - pos)) & mask;
+      }
+
+      uint32_t bits[SIGMA];
+      uint32_t pop[SIGMA];
+
+      occ_word(w, mask, bits, pop);
+      for (int c = 0 ; c < SIGMA ; c++) {
+         test_assert(bits[c] == expected[c]);
+         test_assert(pop[c] == __builtin_popcount(expected[c]));
+      }
+
+      kernel(w, mask, bits, pop);
+      for (int c = 0 ; c < SIGMA ; c++) {
+         test_assert(bits[c] == expected[c]);
+         test_assert(pop[c] == __builtin_popcount(expected[c]));
+      }
+   }
+
+}
+
+
 void
 test_create_occ
 (void)
@@ -167,6 +367,150 @@ test_create_occ
 }
 
 
+void
+test_create_occ_mt
+(void)
+{
+
+   // Check texts shorter than one 'blocc_t' per thread,
+   // a text that fills the last 'blocc_t' exactly and
+   // a text with many 'blocc_t'.
+   const size_t lens[] = {13, 95, 50000};
+
+   for (int k = 0 ; k < 3 ; k++) {
+
+      const size_t len = lens[k];
+      char *txt = random_text(len);
+      test_assert_critical(txt != NULL);
+
+      int64_t *SA = compute_sa(txt);
+      test_assert_critical(SA != NULL);
+
+      bwt_t *BWT = create_bwt(txt, SA);
+      test_assert_critical(BWT != NULL);
+
+      occ_t *occ = create_occ(BWT);
+      test_assert_critical(occ != NULL);
+
+      const size_t sz = occ_size(occ);
+
+      for (int nthreads = 1 ; nthreads <= 7 ; nthreads += 2) {
+         occ_t *occmt = create_occ_mt(BWT, nthreads);
+         test_assert_critical(occmt != NULL);
+         test_assert(memcmp(occmt, occ, sz) == 0);
+         free(occmt);
+      }
+
+      free(occ);
+      free(BWT);
+      free(SA);
+      free(txt);
+
+   }
+
+}
+
+
+void
+test_create_index
+(void)
+{
+
+   // Check a text that fills the last 'blocc_t' exactly
+   // and a text with repeats.
+   const size_t lens[] = {31, 50000};
+
+   for (int k = 0 ; k < 2 ; k++) {
+
+      const size_t len = lens[k];
+      char *txt = random_text(len);
+      test_assert_critical(txt != NULL);
+      if (len > 10000) memcpy(txt + len/2, txt, 5000);
+
+      int64_t *SA = compute_sa(txt);
+      test_assert_critical(SA != NULL);
+
+      bwt_t *BWT = create_bwt(txt, SA);
+      test_assert_critical(BWT != NULL);
+      occ_t *occ = create_occ(BWT);
+      test_assert_critical(occ != NULL);
+      csa_t *csa = compress_sa(SA);
+      test_assert_critical(csa != NULL);
+
+      // Check the Occ table against a plain count.
+      size_t count[SIGMA] = {0};
+      for (size_t pos = 0 ; pos < BWT->txtlen ; pos++) {
+         uint8_t c = BWT->slots[pos/4] >> 2*(pos % 4) & 0b11;
+         if (pos != BWT->zero) count[c]++;
+         for (int j = 0 ; j < SIGMA ; j++)
+            test_assert(get_rank(occ, j, pos) == occ->C[j] + count[j]);
+      }
+
+      // The fused build gives the same output.
+      bwt_t *BWTf;
+      occ_t *occf;
+      csa_t *csaf;
+      create_index(txt, SA, &BWTf, &occf, &csaf);
+      test_assert_critical(BWTf != NULL);
+      test_assert_critical(occf != NULL);
+      test_assert_critical(csaf != NULL);
+
+      test_assert(BWTf->zero == BWT->zero);
+      test_assert(memcmp(BWTf->slots, BWT->slots, BWT->nslots) == 0);
+      test_assert(memcmp(occf, occ, occ_size(occ)) == 0);
+      test_assert(memcmp(csaf, csa, sizeof(csa_t) +
+               csa->nint64 * sizeof(int64_t)) == 0);
+
+      free(csaf);
+      free(occf);
+      free(BWTf);
+
+      // And so does the fused build on several threads.
+      for (int nthreads = 2 ; nthreads <= 8 ; nthreads *= 2) {
+         create_index_mt(txt, SA, nthreads, &BWTf, &occf, &csaf);
+         test_assert_critical(BWTf != NULL);
+         test_assert_critical(occf != NULL);
+         test_assert_critical(csaf != NULL);
+
+         test_assert(BWTf->zero == BWT->zero);
+         test_assert(memcmp(BWTf->slots, BWT->slots, BWT->nslots) == 0);
+         test_assert(memcmp(occf, occ, occ_size(occ)) == 0);
+         test_assert(memcmp(csaf, csa, sizeof(csa_t) +
+                  csa->nint64 * sizeof(int64_t)) == 0);
+
+         free(csaf);
+         free(occf);
+         free(BWTf);
+      }
+
+      // And so does the build by blocks.
+      // The budget allows about 20000 suffixes per block.
+      create_index_direct(txt, 160000, &BWTf, &occf, &csaf);
+      test_assert_critical(BWTf != NULL);
+      test_assert_critical(occf != NULL);
+      test_assert_critical(csaf != NULL);
+
+      test_assert(BWTf->zero == BWT->zero);
+      test_assert(memcmp(BWTf->slots, BWT->slots, BWT->nslots) == 0);
+      test_assert(memcmp(occf, occ, occ_size(occ)) == 0);
+      test_assert(memcmp(csaf, csa, sizeof(csa_t) +
+               csa->nint64 * sizeof(int64_t)) == 0);
+
+      free(csaf);
+      free(occf);
+      free(BWTf);
+
+      free(csa);
+      free(occ);
+      free(BWT);
+      free(SA);
+      free(txt);
+
+   }
+
+}
+
+
 void
 test_get_rank
 (void)
@@ -198,8 +542,324 @@ test_get_rank
    }
    }
 
+   // Same with all the symbols at once and the other layout.
+   occ_t *iocc = layout_occ(occ, OCC_INTERLEAVED);
+   test_assert_critical(iocc != NULL);
+   test_assert(iocc->layout == OCC_INTERLEAVED);
+
+   for (int i = 0 ; i < 14 ; i++) {
+      size_t all[SIGMA];
+      size_t iall[SIGMA];
+      get_rank_all(occ, i, all);
+      get_rank_all(iocc, i, iall);
+      for (int j = 0 ; j < 4 ; j++) {
+         test_assert(get_rank(iocc, j, i) == rank[j][i]);
+         test_assert(all[j] == rank[j][i]);
+         test_assert(iall[j] == rank[j][i]);
+      }
+   }
+
+   free(iocc);
+   free(occ);
+   free(BWT);
+
+}
+
+
+void
+test_layout_occ
+(void)
+{
+
+   const size_t txtlen = 5000;
+   char *txt = random_text(txtlen);
+   test_assert_critical(txt != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   free(SA);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+
+   occ_t *iocc = layout_occ(occ, OCC_INTERLEAVED);
+   test_assert_critical(iocc != NULL);
+
+   // The entries of a row are contiguous.
+   test_assert(occ_entry(iocc, 0, 1) == iocc->rows + SIGMA);
+   test_assert(occ_entry(iocc, 3, 7) - occ_entry(iocc, 0, 7) == 3);
+
+   for (size_t pos = 0 ; pos <= txtlen ; pos++) {
+      size_t all[SIGMA];
+      get_rank_all(iocc, pos, all);
+      for (int c = 0 ; c < SIGMA ; c++) {
+         test_assert(get_rank(iocc, c, pos) == get_rank(occ, c, pos));
+         test_assert(all[c] == get_rank(occ, c, pos));
+      }
+   }
+
+   // The lookup tables are the same.
+   lut_t *lut = create_lut(occ, BWT, 4);
+   lut_t *ilut = create_lut(iocc, BWT, 4);
+   test_assert_critical(lut != NULL && ilut != NULL);
+   test_assert(memcmp(lut, ilut, sizeof(lut_t) + lut->nbytes) == 0);
+
+   // Back to the original layout.
+   occ_t *socc = layout_occ(iocc, OCC_SPLIT);
+   test_assert_critical(socc != NULL);
+   test_assert(memcmp(socc, occ, occ_size(occ)) == 0);
+
+   free(socc);
+   free(ilut);
+   free(lut);
+   free(iocc);
+   free(occ);
+   free(BWT);
+   free(txt);
+
+}
+
+
+void
+test_occ_super
+(void)
+{
+
+   const size_t txtlen = 3000;
+   char *txt = random_text(txtlen);
+   test_assert_critical(txt != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   free(SA);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+
+   // A single superblock with zero counts.
+   test_assert(occ_size(occ) == sizeof(occ_t) +
+         SIGMA * occ->nrows * sizeof(blocc_t) + SIGMA * sizeof(uint64_t));
+   for (int c = 0 ; c < SIGMA ; c++)
+      test_assert(occ_super(occ)[c] == 0);
+
+   // Pretend that the text is preceded by 2^32 + 2^32 - 100 'C' in
+   // the same superblock (i.e. shift the counts of 'C'), so that the
+   // samples of 'C' wrap around 2^32 in the middle of the table.
+   const uint64_t shift = (1ULL << 33) - 100;
+   occ_t *wocc = layout_occ(occ, OCC_INTERLEAVED);
+   test_assert_critical(wocc != NULL);
+   for (size_t row = 0 ; row < wocc->nrows ; row++)
+      wocc->rows[row*SIGMA + 1].smpl += (uint32_t) shift;
+   occ_super(wocc)[1] = shift;
+
+   int wrapped = 0;
+   for (size_t pos = 0 ; pos <= txtlen ; pos++) {
+      wrapped |= wocc->rows[pos/32*SIGMA + 1].smpl < (uint32_t) shift;
+      size_t all[SIGMA];
+      get_rank_all(wocc, pos, all);
+      for (int c = 0 ; c < SIGMA ; c++) {
+         const size_t expected = get_rank(occ, c, pos) + (c == 1) * shift;
+         test_assert(get_rank(wocc, c, pos) == expected);
+         test_assert(all[c] == expected);
+      }
+   }
+   test_assert(wrapped);
+
+   free(wocc);
+   free(occ);
+   free(BWT);
+   free(txt);
+
+}
+
+
+void
+test_pack_occ
+(void)
+{
+
+   const size_t txtlen = 3000;
+   char *txt = random_text(txtlen);
+   test_assert_critical(txt != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+   csa_t *csa = compress_sa(SA);
+   test_assert_critical(csa != NULL);
+   free(SA);
+
+   test_assert(occ->zero == BWT->zero);
+
+   occ_t *pocc = layout_occ(occ, OCC_PACKED);
+   test_assert_critical(pocc != NULL);
+   test_assert(pocc->layout == OCC_PACKED);
+   test_assert(pocc->nrows == (txtlen + 1 + 191) / 192);
+   test_assert(pocc->zero == BWT->zero);
+
+   // A line per 192 positions, and one superblock.
+   test_assert(occ_size(pocc) == sizeof(occ_t) +
+         pocc->nrows * 64 + SIGMA * sizeof(uint64_t));
+   // The packed table cannot be converted.
+   test_assert(layout_occ(pocc, OCC_SPLIT) == NULL);
+
+   for (size_t pos = 0 ; pos <= txtlen ; pos++) {
+      if (pos != BWT->zero) {
+         test_assert(get_symbol(NULL, pocc, pos) ==
+               get_symbol(BWT, occ, pos));
+      }
+      size_t all[SIGMA];
+      get_rank_all(pocc, pos, all);
+      for (int c = 0 ; c < SIGMA ; c++) {
+         test_assert(get_rank(pocc, c, pos) == get_rank(occ, c, pos));
+         test_assert(all[c] == get_rank(occ, c, pos));
+      }
+   }
+
+   // The suffix array is queried without the BWT.
+   bwt_t header = *BWT;
+   header.nslots = 0;
+   for (size_t pos = 0 ; pos <= txtlen ; pos += 7) {
+      test_assert(query_csa(csa, &header, pocc, pos) ==
+            query_csa(csa, BWT, occ, pos));
+   }
+
+   // The lookup tables are the same.
+   lut_t *lut = create_lut(occ, BWT, 4);
+   lut_t *plut = create_lut(pocc, &header, 4);
+   test_assert_critical(lut != NULL && plut != NULL);
+   test_assert(memcmp(lut, plut, sizeof(lut_t) + lut->nbytes) == 0);
+
+   free(plut);
+   free(lut);
+   free(pocc);
+   free(csa);
    free(occ);
    free(BWT);
+   free(txt);
+
+}
+
+
+void
+test_get_rank_range
+(void)
+{
+
+   const size_t txtlen = 3000;
+   char *txt = random_text(txtlen);
+   test_assert_critical(txt != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   free(SA);
+
+   occ_t *occs[3];
+   occs[0] = create_occ(BWT);
+   test_assert_critical(occs[0] != NULL);
+   occs[1] = layout_occ(occs[0], OCC_INTERLEAVED);
+   occs[2] = layout_occ(occs[0], OCC_PACKED);
+   test_assert_critical(occs[1] != NULL && occs[2] != NULL);
+
+   for (int i = 0 ; i < 3 ; i++) {
+      const occ_t *occ = occs[i];
+      for (int iter = 0 ; iter < 20000 ; iter++) {
+         // Mostly narrow ranges, some of them around the '$'
+         // and some of them empty.
+         size_t bot = iter % 10 == 0 ? BWT->zero - rand() % 8 :
+            rand() % (txtlen + 1);
+         size_t top = bot + (iter % 3 ? rand() % 40 : rand() % 400) - 1;
+         if (bot > txtlen) bot = txtlen;
+         if (top > txtlen) top = txtlen;
+         if (iter % 50 == 0) bot = 0;
+         for (int c = 0 ; c < SIGMA ; c++) {
+            range_t range = get_rank_range(occ, c,
+                  (range_t) { .bot = bot, .top = top });
+            size_t expected = bot > 0 ?
+               get_rank(occs[0], c, bot - 1) : occs[0]->C[c];
+            test_assert(range.bot == expected);
+            test_assert(range.top == get_rank(occs[0], c, top) - 1);
+         }
+      }
+   }
+
+   free(occs[2]);
+   free(occs[1]);
+   free(occs[0]);
+   free(BWT);
+   free(txt);
+
+}
+
+
+void
+test_rank_kernel
+(void)
+{
+
+   // The variant of the kernels selected for this CPU must
+   // give the same results as the generic code.
+   size_t (*rank)(const occ_t *, uint8_t, size_t) = get_rank_kernel();
+   void (*rank_all)(const occ_t *, size_t, size_t *) =
+      get_rank_all_kernel();
+   range_t (*rank_range)(const occ_t *, const uint8_t, const range_t) =
+      get_rank_range_kernel();
+   range_t (*search)(const char *, const size_t, const occ_t *,
+         const lut_t *) = backward_search_kernel();
+
+   const size_t txtlen = 3000;
+   char *txt = random_text(txtlen);
+   test_assert_critical(txt != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   free(SA);
+
+   occ_t *occs[3];
+   occs[0] = create_occ(BWT);
+   test_assert_critical(occs[0] != NULL);
+   occs[1] = layout_occ(occs[0], OCC_INTERLEAVED);
+   occs[2] = layout_occ(occs[0], OCC_PACKED);
+   test_assert_critical(occs[1] != NULL && occs[2] != NULL);
+
+   for (int i = 0 ; i < 3 ; i++) {
+      const occ_t *occ = occs[i];
+      for (size_t pos = 0 ; pos <= txtlen ; pos++) {
+         size_t all[SIGMA], expected[SIGMA];
+         rank_all(occ, pos, all);
+         get_rank_all_generic(occ, pos, expected);
+         for (int c = 0 ; c < SIGMA ; c++) {
+            test_assert(rank(occ, c, pos) == get_rank_generic(occ, c, pos));
+            test_assert(all[c] == expected[c]);
+            range_t range = { .bot = pos, .top = pos + rand() % 40 };
+            if (range.top > txtlen) range.top = txtlen;
+            range_t a = rank_range(occ, c, range);
+            range_t b = get_rank_range_generic(occ, c, range);
+            test_assert(a.bot == b.bot && a.top == b.top);
+         }
+      }
+      for (size_t from = 0 ; from < txtlen - 20 ; from += 7) {
+         range_t a = search(txt + from, 20, occ, NULL);
+         range_t b = backward_search_generic(txt + from, 20, occ, NULL);
+         test_assert(a.bot == b.bot && a.top == b.top);
+         test_assert(a.bot <= a.top);
+      }
+   }
+
+   free(occs[2]);
+   free(occs[1]);
+   free(occs[0]);
+   free(BWT);
+   free(txt);
 
 }
 
@@ -222,14 +882,26 @@ test_fill_lut
    occ_t *occ = create_occ(BWT);
    test_assert_critical(occ != NULL);
 
-   lut_t *lut = calloc(1, sizeof(lut_t));
+   lut_t *lut = calloc(1, sizeof(lut_t) + 5 * (1 << 24) + 8);
    test_assert_critical(lut != NULL);
+   lut->k = 12;
+   lut->width = 5;
 
-   // k-mer "ATGCGAGAGAT" has ID 3285612
-   fill_lut(lut, occ, (range_t) {.bot=4, .top=4} , 11, 3285612);
-   // k-mer "GATGCGAGAGAT" has ID 13142450
-   test_assert(lut->kmer[13142450].bot == 10);
-   test_assert(lut->kmer[13142450].top == 10);
+   // k-mer "ATGCGAGAGAT" has ID 942627
+   fill_lut(lut, occ, (range_t) {.bot=4, .top=4} , 11, 942627);
+   // k-mer "GATGCGAGAGAT" has ID 9331235
+   test_assert(memcmp(lut->bound + 5 * 9331235, "\x0a\0\0\0\0", 5) == 0);
+
+   free(lut);
+
+   lut = create_lut(occ, BWT, 12);
+   test_assert_critical(lut != NULL);
+   test_assert(lut->width == 4);
+   test_assert(lut->ntail == 11);
+
+   range_t range = lookup_lut(lut, 9331235);
+   test_assert(range.bot == 10);
+   test_assert(range.top == 10);
 
    free(lut);
    free(occ);
@@ -238,6 +910,72 @@ test_fill_lut
 }
 
 
+void
+test_lookup_lut
+(void)
+{
+
+   // Check a random text, a text that ends with the first
+   // k-mer and a text shorter than the k-mers.
+   const size_t lens[] = {3000, 3000, 4};
+   const size_t k = 5;
+
+   for (int t = 0 ; t < 3 ; t++) {
+
+      const size_t len = lens[t];
+      char *txt = random_text(len);
+      test_assert_critical(txt != NULL);
+      if (t == 1) memset(txt + len - 8, 'A', 8);
+
+      int64_t *SA = compute_sa(txt);
+      test_assert_critical(SA != NULL);
+
+      bwt_t *BWT = create_bwt(txt, SA);
+      test_assert_critical(BWT != NULL);
+
+      free(SA);
+
+      occ_t *occ = create_occ(BWT);
+      test_assert_critical(occ != NULL);
+
+      lut_t *lut = create_lut(occ, BWT, k);
+      test_assert_critical(lut != NULL);
+      test_assert(lut->ntail == (len < k-1 ? len : k-1));
+
+      // The table is the same on several threads.
+      for (int nthreads = 2 ; nthreads <= 64 ; nthreads *= 2) {
+         lut_t *lutmt = create_lut_mt(occ, BWT, k, nthreads);
+         test_assert_critical(lutmt != NULL);
+         test_assert(memcmp(lutmt, lut, sizeof(lut_t) + lut->nbytes) == 0);
+         free(lutmt);
+      }
+
+      // Compare all k-mers with the backward search.
+      char kmer[6] = {0};
+      for (size_t id = 0 ; id < (1 << 2*k) ; id++) {
+         for (int i = 0 ; i < k ; i++)
+            kmer[i] = ALPHABET[id >> 2*(k-1-i) & 0b11];
+         range_t a = backward_search(kmer, k, occ, NULL);
+         range_t b = lookup_lut(lut, id);
+         if (a.top < a.bot) {
+            test_assert(b.top < b.bot);
+         }
+         else {
+            test_assert(a.bot == b.bot);
+            test_assert(a.top == b.top);
+         }
+      }
+
+      free(lut);
+      free(occ);
+      free(BWT);
+      free(txt);
+
+   }
+
+}
+
+
 void
 test_backward_search
 (void)
@@ -256,16 +994,440 @@ test_backward_search
    occ_t *occ = create_occ(BWT);
    test_assert_critical(occ != NULL);
 
-   range_t range = backward_search("GATGCGAGAGAT", 12, occ);
+   range_t range = backward_search("GATGCGAGAGAT", 12, occ, NULL);
 
    test_assert(range.bot == 10);
    test_assert(range.top == 10);
 
+   // Queries with symbols outside the alphabet are not found.
+   range = backward_search("GATGNGAGAGAT", 12, occ, NULL);
+   test_assert(range.top < range.bot);
+
+   // Same with the lookup table.
+   lut_t *lut = create_lut(occ, BWT, 10);
+   test_assert_critical(lut != NULL);
+
+   range = backward_search("GATGCGAGAGAT", 12, occ, lut);
+
+   test_assert(range.bot == 10);
+   test_assert(range.top == 10);
+
+   // Check queries longer than the k-mers, present or not.
+   const char *queries[] = {
+      "GATGCGAGAGATG", "ATGCGAGAGATG", "GGATGCGAGAGAT",
+      "TGCGAGAGATGA", "AAAAAAAAAAAAAA", "CGAGAGATG",
+   };
+   for (int i = 0 ; i < 6 ; i++) {
+      const size_t len = strlen(queries[i]);
+      range_t a = backward_search(queries[i], len, occ, NULL);
+      range_t b = backward_search(queries[i], len, occ, lut);
+      if (a.top < a.bot) {
+         test_assert(b.top < b.bot);
+      }
+      else {
+         test_assert(a.bot == b.bot);
+         test_assert(a.top == b.top);
+      }
+   }
+
+   free(lut);
+
    free(occ);
    free(BWT);
 
 }
 
+void
+test_translate_pos
+(void)
+{
+
+   // Contigs "chr1" (10), "" (empty), "chr3" (5) and "chr4" (23).
+   // "chr4" has a gap of 3 symbols at position 10, so the
+   // text is made of the segments 0-9, 10-14, 15-24 and 25-34.
+   const size_t chrlen[] = {10, 0, 5, 23};
+   const char names[] = "chr1\0\0chr3\0chr4";
+   const seg_t segs[] = {
+      { .start =  0, .chr = 0, .off =  0 },
+      { .start = 10, .chr = 1, .off =  0 },
+      { .start = 10, .chr = 2, .off =  0 },
+      { .start = 15, .chr = 3, .off =  0 },
+      { .start = 25, .chr = 3, .off = 13 },
+   };
+   chr_t *chr = create_chr(35, 4, chrlen, names, 5, segs);
+   test_assert_critical(chr != NULL);
+
+   test_assert(strcmp(chr_name(chr, 0), "chr1") == 0);
+   test_assert(strcmp(chr_name(chr, 1), "") == 0);
+   test_assert(strcmp(chr_name(chr, 2), "chr3") == 0);
+   test_assert(strcmp(chr_name(chr, 3), "chr4") == 0);
+   test_assert(chr_len(chr, 3) == 23);
+
+   for (size_t pos = 0 ; pos < 35 ; pos++) {
+      size_t expected = pos < 10 ? 0 : pos < 15 ? 2 : pos < 25 ? 3 : 4;
+      test_assert(find_seg(chr, pos) == expected);
+   }
+
+   locus_t locus;
+
+   test_assert(translate_pos(chr, 12, 3, &locus));
+   test_assert(locus.chr == 2);
+   test_assert(locus.pos == 2);
+   test_assert(locus.strand == '+');
+
+   // After the gap of "chr4".
+   test_assert(translate_pos(chr, 26, 3, &locus));
+   test_assert(locus.chr == 3);
+   test_assert(locus.pos == 14);
+   test_assert(locus.strand == '+');
+
+   // Straddles the junction of "chr3" and "chr4", and the gap.
+   test_assert(!translate_pos(chr, 13, 3, &locus));
+   test_assert(!translate_pos(chr, 23, 3, &locus));
+
+   // The reverse complement of "chr1" is at 60-69. The hit at 60-62
+   // is the reverse complement of 7-9 on the forward strand.
+   test_assert(translate_pos(chr, 60, 3, &locus));
+   test_assert(locus.chr == 0);
+   test_assert(locus.pos == 7);
+   test_assert(locus.strand == '-');
+
+   // Straddles "chr3" and "chr1" on the reverse strand, and the
+   // junction of the two strands.
+   test_assert(!translate_pos(chr, 58, 3, &locus));
+   test_assert(!translate_pos(chr, 34, 2, &locus));
+   test_assert(!translate_pos(chr, 69, 2, &locus));
+
+   free(chr);
+
+   // Many segments of random sizes.
+   seg_t many[1000];
+   size_t gsize = 0;
+   srand(123);
+   for (int i = 0 ; i < 1000 ; i++) {
+      many[i] = (seg_t) { .start = gsize, .chr = 0, .off = 0 };
+      gsize += rand() % 5;
+   }
+   chr = create_chr(gsize, 1, &gsize, "", 1000, many);
+   test_assert_critical(chr != NULL);
+   for (size_t pos = 0 ; pos < gsize ; pos++) {
+      size_t i = find_seg(chr, pos);
+      test_assert(many[i].start <= pos);
+      test_assert(i == 999 || many[i+1].start > pos);
+   }
+   free(chr);
+
+}
+
+
+int
+compare_loci
+(
+   const void * a,
+   const void * b
+)
+{
+   const locus_t * x = a;
+   const locus_t * y = b;
+   if (x->chr != y->chr) return x->chr < y->chr ? -1 : 1;
+   if (x->pos != y->pos) return x->pos < y->pos ? -1 : 1;
+   return x->strand - y->strand;
+}
+
+
+void
+test_locate
+(void)
+{
+
+   // Two contigs of 300 and 700 nucleotides, followed
+   // by the reverse complement.
+   const size_t gsize = 1000;
+   char *txt = random_genome(gsize);
+   test_assert_critical(txt != NULL);
+
+   const size_t chrlen[] = {300, 700};
+   const seg_t segs[] = {
+      { .start =   0, .chr = 0, .off = 0 },
+      { .start = 300, .chr = 1, .off = 0 },
+   };
+   chr_t *chr = create_chr(gsize, 2, chrlen, "a\0b", 2, segs);
+   test_assert_critical(chr != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+   csa_t *csa = compress_sa(SA);
+   test_assert_critical(csa != NULL);
+   free(SA);
+
+   locus_t loci[4096];
+   locus_t expected[4096];
+   locus_t pair[4096];
+
+   for (int iter = 0 ; iter < 50 ; iter++) {
+
+      // A query taken from the forward strand and its reverse complement.
+      const size_t len = 3 + iter % 5;
+      char query[8] = {0};
+      char rcquery[8] = {0};
+      size_t from = rand() % (gsize - len);
+      for (size_t i = 0 ; i < len ; i++) {
+         query[i] = txt[from+i];
+         rcquery[len-i-1] = REVCOMP[(uint8_t) txt[from+i]];
+      }
+
+      // Naive scan of the forward strand.
+      size_t nexp = 0;
+      for (size_t pos = 0 ; pos + len <= gsize ; pos++) {
+         // Skip the junction of the contigs.
+         if (pos < 300 && pos + len > 300) continue;
+         const size_t c = pos >= 300;
+         const size_t off = pos - 300*c;
+         if (strncmp(txt + pos, query, len) == 0)
+            expected[nexp++] = (locus_t) { c, off, '+' };
+         if (strncmp(txt + pos, rcquery, len) == 0)
+            expected[nexp++] = (locus_t) { c, off, '-' };
+      }
+      qsort(expected, nexp, sizeof(locus_t), compare_loci);
+
+      range_t range = backward_search(query, len, occ, NULL);
+      size_t n = locate(csa, BWT, occ, chr, range, query, len,
+            LOCATE_QUERY, loci, 4096);
+      qsort(loci, n, sizeof(locus_t), compare_loci);
+
+      test_assert(n == nexp);
+      test_assert(memcmp(loci, expected, n * sizeof(locus_t)) == 0);
+
+      // The pair mode gives the hits of the query and of its reverse
+      // complement without walking the range of the latter (which is
+      // the same range if the query is its own reverse complement).
+      if (strcmp(query, rcquery) != 0) {
+         range_t rcrange = backward_search(rcquery, len, occ, NULL);
+         n += locate(csa, BWT, occ, chr, rcrange, rcquery, len,
+               LOCATE_QUERY, loci + n, 4096 - n);
+         qsort(loci, n, sizeof(locus_t), compare_loci);
+      }
+
+      size_t npair = locate(csa, BWT, occ, chr, range, query, len,
+            LOCATE_PAIR, pair, 4096);
+      qsort(pair, npair, sizeof(locus_t), compare_loci);
+
+      test_assert(npair == n);
+      test_assert(memcmp(pair, loci, n * sizeof(locus_t)) == 0);
+
+   }
+
+   // A query that is its own reverse complement is reported once
+   // per strand, as without pair mode.
+   range_t range = backward_search("ACGT", 4, occ, NULL);
+   test_assert_critical(range.top >= range.bot);
+   size_t n = locate(csa, BWT, occ, chr, range, "ACGT", 4, LOCATE_QUERY,
+         loci, 4096);
+   size_t npair = locate(csa, BWT, occ, chr, range, "ACGT", 4,
+         LOCATE_PAIR, pair, 4096);
+   qsort(loci, n, sizeof(locus_t), compare_loci);
+   qsort(pair, npair, sizeof(locus_t), compare_loci);
+   test_assert(npair == n);
+   test_assert(memcmp(pair, loci, n * sizeof(locus_t)) == 0);
+   for (size_t i = 1 ; i < npair ; i++)
+      test_assert(compare_loci(pair + i - 1, pair + i) != 0);
+
+   // The output stops at 'max'.
+   range = backward_search("A", 1, occ, NULL);
+   test_assert(locate(csa, BWT, occ, chr, range, "A", 1, LOCATE_PAIR,
+            loci, 5) == 4);
+
+   free(csa);
+   free(occ);
+   free(BWT);
+   free(chr);
+   free(txt);
+
+}
+
+
+void
+test_count_hits
+(void)
+{
+
+   // Two contigs of 600 and 400 nucleotides. The first has two gaps
+   // that are removed from the text, leaving a segment of 3
+   // nucleotides. The junctions are at 300, 303, 600, 1000 (the
+   // junction of the strands) and their mirrors 1400, 1697, 1700.
+   const size_t gsize = 1000;
+   char *txt = random_genome(gsize);
+   test_assert_critical(txt != NULL);
+
+   const size_t chrlen[] = {650, 400};
+   const seg_t segs[] = {
+      { .start =   0, .chr = 0, .off =   0 },
+      { .start = 300, .chr = 0, .off = 320 },
+      { .start = 303, .chr = 0, .off = 350 },
+      { .start = 600, .chr = 1, .off =   0 },
+   };
+   const size_t jpos[] = {300, 303, 600, 1000, 1400, 1697, 1700};
+   chr_t *chr = create_chr(gsize, 2, chrlen, "a\0b", 4, segs);
+   test_assert_critical(chr != NULL);
+   test_assert(chr->njct == 7);
+   test_assert(strcmp(chr_name(chr, 1), "b") == 0);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+   csa_t *csa = compress_sa(SA);
+   test_assert_critical(csa != NULL);
+
+   // The rows of the junctions are those of the suffix array.
+   find_junctions(chr, csa, BWT, occ);
+   const uint64_t *jrow = chr->data + 5*chr->nseg + 3 + 2*chr->nchr;
+   for (size_t i = 0 ; i < 7 ; i++) {
+      int found = 0;
+      for (size_t j = 0 ; j < 7 ; j++) found |= SA[jrow[j]] == jpos[i];
+      test_assert(found);
+      test_assert(i == 0 || jrow[i-1] < jrow[i]);
+   }
+
+   // The same in the layout OCC_PACKED (without the BWT).
+   occ_t *packed = layout_occ(occ, OCC_PACKED);
+   test_assert_critical(packed != NULL);
+   chr_t *copy = malloc(sizeof(chr_t) + chr->nbytes);
+   test_assert_critical(copy != NULL);
+   memcpy(copy, chr, sizeof(chr_t) + chr->nbytes);
+   find_junctions(copy, csa, &(bwt_t) { .zero = BWT->zero,
+         .txtlen = BWT->txtlen }, packed);
+   test_assert(memcmp(copy, chr, sizeof(chr_t) + chr->nbytes) == 0);
+   free(copy);
+
+   // A query across the first gap is in the text but not in the
+   // genome, and neither is a query across the segment of 3.
+   range_t range = backward_search(txt + 295, 10, occ, NULL);
+   test_assert(range.top >= range.bot);
+   test_assert(count_hits(txt + 295, 10, range, occ, chr) ==
+         range.top - range.bot);
+   range = backward_search(txt + 298, 8, occ, NULL);
+   test_assert(range.top >= range.bot);
+   test_assert(count_hits(txt + 298, 8, range, occ, chr) ==
+         range.top - range.bot);
+
+   locus_t loci[4096];
+   for (int iter = 0 ; iter < 200 ; iter++) {
+
+      // Queries around the junctions or anywhere on the text.
+      const size_t len = 1 + iter % 12;
+      const size_t from = iter % 2 ? rand() % (2*gsize - len) :
+         jpos[iter % 7] - 1 - rand() % len;
+      char query[16] = {0};
+      memcpy(query, txt + from, len);
+
+      // Naive scan of the text, skipping the hits across a junction.
+      size_t nexp = 0;
+      for (size_t pos = 0 ; pos + len <= 2*gsize ; pos++) {
+         int across = 0;
+         for (int j = 0 ; j < 7 ; j++)
+            across |= pos < jpos[j] && pos + len > jpos[j];
+         nexp += !across && strncmp(txt + pos, query, len) == 0;
+      }
+
+      range_t range = backward_search(query, len, occ, NULL);
+      test_assert(count_hits(query, len, range, occ, chr) == nexp);
+      test_assert(count_hits(query, len, range, packed, chr) == nexp);
+      test_assert(locate(csa, BWT, occ, chr, range, query, len,
+               LOCATE_QUERY, loci, 4096) == nexp);
+
+   }
+
+   // Without the contigs, all the hits are counted.
+   range = backward_search("A", 1, occ, NULL);
+   test_assert(count_hits("A", 1, range, occ, NULL) ==
+         range.top - range.bot + 1);
+   range = backward_search("ACGTTT", 6, occ, NULL);
+   test_assert(count_hits("ACGTTT", 6, range, occ, NULL) ==
+         range.top - range.bot + 1);
+
+   free(SA);
+   free(csa);
+   free(packed);
+   free(occ);
+   free(BWT);
+   free(chr);
+   free(txt);
+
+}
+
+
+void
+test_backward_search_batch
+(void)
+{
+
+   const size_t txtlen = 2000;
+   char *txt = random_text(txtlen);
+   test_assert_critical(txt != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   free(SA);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+   lut_t *lut = create_lut(occ, BWT, 5);
+   test_assert_critical(lut != NULL);
+
+   // Substrings of the text, with a mismatch or a
+   // symbol outside the alphabet in some of them.
+   const size_t n = 500;
+   char (*buff)[32] = malloc(n * sizeof(*buff));
+   const char **query = malloc(n * sizeof(char *));
+   size_t *len = malloc(n * sizeof(size_t));
+   range_t *range = malloc(n * sizeof(range_t));
+   test_assert_critical(buff && query && len && range);
+   for (size_t i = 0 ; i < n ; i++) {
+      len[i] = rand() % 31;
+      size_t pos = rand() % (txtlen - len[i] + 1);
+      memcpy(buff[i], txt + pos, len[i]);
+      if (len[i] > 0 && i % 5 == 1) buff[i][rand() % len[i]] = 'A';
+      if (len[i] > 0 && i % 7 == 2) buff[i][rand() % len[i]] = 'N';
+      query[i] = buff[i];
+   }
+
+   for (int with_lut = 0 ; with_lut < 2 ; with_lut++) {
+      const lut_t *l = with_lut ? lut : NULL;
+      backward_search_batch(query, len, n, occ, l, range);
+      for (size_t i = 0 ; i < n ; i++) {
+         range_t expected = backward_search(query[i], len[i], occ, l);
+         test_assert(range[i].bot == expected.bot);
+         test_assert(range[i].top == expected.top);
+      }
+   }
+
+   // Fewer queries than lanes.
+   backward_search_batch(query, len, 3, occ, lut, range);
+   for (size_t i = 0 ; i < 3 ; i++) {
+      range_t expected = backward_search(query[i], len[i], occ, lut);
+      test_assert(range[i].bot == expected.bot);
+      test_assert(range[i].top == expected.top);
+   }
+
+   free(range);
+   free(len);
+   free(query);
+   free(buff);
+   free(lut);
+   free(occ);
+   free(BWT);
+   free(txt);
+
+}
+
 void
 test_query_csa
 (void)
@@ -298,16 +1460,290 @@ test_query_csa
 
 }
 
+void
+test_write_index
+(void)
+{
+
+   const size_t gsize = 500;
+   char *txt = random_genome(gsize);
+   test_assert_critical(txt != NULL);
+
+   const seg_t seg = { .start = 0, .chr = 0, .off = 0 };
+   chr_t *chr = create_chr(gsize, 1, &gsize, "a", 1, &seg);
+   test_assert_critical(chr != NULL);
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+   csa_t *csa = compress_sa(SA);
+   test_assert_critical(csa != NULL);
+   lut_t *lut = create_lut(occ, BWT, 5);
+   test_assert_critical(lut != NULL);
+   free(SA);
+
+   index_t idx = { BWT, occ, csa, lut, chr };
+   write_index("test.idx", &idx);
+
+   int fd = open("test.idx", O_RDONLY);
+   test_assert_critical(fd >= 0);
+   size_t mmsz = lseek(fd, 0, SEEK_END);
+   char *map = mmap(NULL, mmsz, PROT_READ, MAP_PRIVATE, fd, 0);
+   test_assert_critical(map != MAP_FAILED);
+   close(fd);
+
+   index_t parsed;
+   test_assert(parse_index(map, mmsz, &parsed) == 0);
+
+   // The sections are aligned and identical to the originals.
+   test_assert((char *) parsed.bwt - map == IDX_ALIGN);
+   test_assert(((char *) parsed.occ - map) % IDX_ALIGN == 0);
+   test_assert(((char *) parsed.csa - map) % IDX_ALIGN == 0);
+   test_assert(((char *) parsed.lut - map) % IDX_ALIGN == 0);
+   test_assert(((char *) parsed.chr - map) % IDX_ALIGN == 0);
+   test_assert(memcmp(parsed.bwt, BWT,
+            sizeof(bwt_t) + BWT->nslots) == 0);
+   test_assert(memcmp(parsed.occ, occ,
+            occ_size(occ)) == 0);
+   test_assert(memcmp(parsed.csa, csa,
+            sizeof(csa_t) + csa->nint64 * sizeof(int64_t)) == 0);
+   test_assert(memcmp(parsed.lut, lut, sizeof(lut_t) + lut->nbytes) == 0);
+   test_assert(memcmp(parsed.chr, chr, sizeof(chr_t) + chr->nbytes) == 0);
+
+   // Damaged or truncated files are rejected.
+   char *copy = malloc(mmsz);
+   test_assert_critical(copy != NULL);
+   memcpy(copy, map, mmsz);
+
+   // Cut in the last section.
+   const size_t cut = (char *) parsed.chr - map + 1;
+   occ_t *badocc = (occ_t *) (copy + ((char *) parsed.occ - map));
+   csa_t *badcsa = (csa_t *) (copy + ((char *) parsed.csa - map));
+   lut_t *badlut = (lut_t *) (copy + ((char *) parsed.lut - map));
+   chr_t *badchr = (chr_t *) (copy + ((char *) parsed.chr - map));
+
+   redirect_stderr();
+   test_assert(parse_index(copy, sizeof(idxhdr_t) - 1, &parsed) == -1);
+   test_assert(parse_index(copy, cut, &parsed) == -1);
+   copy[offsetof(idxhdr_t, txtlen)] ^= 1;
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+
+   memcpy(copy, map, sizeof(idxhdr_t));
+   ((idxhdr_t *) copy)->version++;
+   redirect_stderr();
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+   test_assert_stderr("invalid index: hdr->version != IDX_VERSION");
+
+   // The header is intact, but the body is not consistent with it.
+   memcpy(copy, map, sizeof(idxhdr_t));
+   test_assert(parse_index(copy, mmsz, &parsed) == 0);
+   badocc->nrows--;
+   redirect_stderr();
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+   test_assert_stderr("invalid index: occ->nrows != "
+         "(txtlen + (span-1)) / span");
+   badocc->nrows++;
+   badocc->C[2] = badocc->C[3] + 1;
+   redirect_stderr();
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+   test_assert_stderr("invalid index: occ->C[i] > occ->C[i+1]");
+   badocc->C[2] = occ->C[2];
+   badcsa->nbits++;
+   redirect_stderr();
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+   test_assert_stderr("invalid index: csa->nbits != nbits");
+   badcsa->nbits--;
+   badlut->k++;
+   redirect_stderr();
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+   test_assert_stderr("invalid index: lut->nbytes != "
+         "lut->width * ((1ULL << 2*lut->k) + 1) + 8");
+   badlut->k--;
+   badchr->data[3*chr->nseg+3] = 1;
+   redirect_stderr();
+   test_assert(parse_index(copy, mmsz, &parsed) == -1);
+   unredirect_stderr();
+   test_assert_stderr("invalid index: segchr[i] >= chr->nchr");
+   badchr->data[3*chr->nseg+3] = 0;
+   test_assert(parse_index(copy, mmsz, &parsed) == 0);
+
+   // Optional sections can be absent.
+   idx.lut = NULL;
+   idx.chr = NULL;
+   write_index("test.idx", &idx);
+   munmap(map, mmsz);
+   fd = open("test.idx", O_RDONLY);
+   test_assert_critical(fd >= 0);
+   mmsz = lseek(fd, 0, SEEK_END);
+   map = mmap(NULL, mmsz, PROT_READ, MAP_PRIVATE, fd, 0);
+   test_assert_critical(map != MAP_FAILED);
+   close(fd);
+   test_assert(parse_index(map, mmsz, &parsed) == 0);
+   test_assert(parsed.lut == NULL);
+   test_assert(parsed.chr == NULL);
+
+   munmap(map, mmsz);
+   unlink("test.idx");
+   free(copy);
+   free(lut);
+   free(csa);
+   free(occ);
+   free(BWT);
+   free(chr);
+   free(txt);
+
+}
+
+
+void
+test_load_index
+(void)
+{
+
+   const char txt[] = "GATGCGAGAGATGGATGCGAGAGATGCATCTCTCGCATCCATCTCTCGCATC";
+
+   int64_t *SA = compute_sa(txt);
+   test_assert_critical(SA != NULL);
+   bwt_t *BWT = create_bwt(txt, SA);
+   test_assert_critical(BWT != NULL);
+   occ_t *occ = create_occ(BWT);
+   test_assert_critical(occ != NULL);
+   csa_t *csa = compress_sa(SA);
+   test_assert_critical(csa != NULL);
+   lut_t *lut = create_lut(occ, BWT, 3);
+   test_assert_critical(lut != NULL);
+   free(SA);
+
+   write_index("test.idx", &(index_t) {
+      .bwt = BWT, .occ = occ, .csa = csa, .lut = lut });
+
+   range_t expected = backward_search("GAGA", 4, occ, lut);
+   test_assert(expected.top - expected.bot == 3);
+
+   const int policies[] = { LOAD_POPULATE, LOAD_LAZY, LOAD_COPY };
+   for (int i = 0 ; i < 3 ; i++) {
+      index_t idx;
+      test_assert_critical(load_index("test.idx", policies[i], &idx) == 0);
+      test_assert((uintptr_t) idx.bwt % IDX_ALIGN == 0 ||
+            policies[i] != LOAD_COPY);
+      test_assert(memcmp(idx.bwt, BWT, sizeof(bwt_t) + BWT->nslots) == 0);
+      test_assert(idx.chr == NULL);
+      test_assert(idx.loadtime >= 0);
+      test_assert(idx.resident <= idx.mapsz);
+      range_t range = backward_search("GAGA", 4, idx.occ, idx.lut);
+      test_assert(range.bot == expected.bot);
+      test_assert(range.top == expected.top);
+      unload_index(&idx);
+      test_assert(idx.map == NULL);
+   }
+
+   // Huge pages may not be reserved on the host.
+   index_t idx;
+   redirect_stderr();
+   int hugetlb = load_index("test.idx", LOAD_HUGETLB, &idx);
+   unredirect_stderr();
+   if (hugetlb == 0) {
+      test_assert(idx.mapsz % IDX_ALIGN == 0);
+      test_assert(memcmp(idx.bwt, BWT, sizeof(bwt_t) + BWT->nslots) == 0);
+      unload_index(&idx);
+   }
+
+   test_assert(load_policy("lazy") == LOAD_LAZY);
+   test_assert(load_policy("hugetlb1g") == LOAD_HUGETLB_1G);
+   test_assert(load_policy("none") == -1);
+
+   // The copy is fully resident.
+   test_assert_critical(load_index("test.idx", LOAD_COPY, &idx) == 0);
+   test_assert(resident_size(&idx) >= sizeof(idxhdr_t));
+   unload_index(&idx);
+
+   // The shared segment is attached by the identity of the file.
+   test_assert_critical(share_index("test.idx") == 0);
+   test_assert(load_index("./test.idx", LOAD_SHARED, &idx) == 0);
+   test_assert(memcmp(idx.occ, occ, sizeof(occ_t)) == 0);
+   unload_index(&idx);
+
+   // Another file with the same base name has its own segment.
+   char name[256], other[256];
+   test_assert_critical(mkdir("shm", 0755) == 0);
+   write_index("shm/test.idx", &(index_t) {
+      .bwt = BWT, .occ = occ, .csa = csa });
+   test_assert(index_shm_name("test.idx", name, sizeof(name)) == 0);
+   test_assert(index_shm_name("shm/test.idx", other, sizeof(other)) == 0);
+   test_assert(strcmp(name, other) != 0);
+   redirect_stderr();
+   test_assert(load_index("shm/test.idx", LOAD_SHARED, &idx) == -1);
+   unredirect_stderr();
+   test_assert_stderr("cannot open shared memory segment 'shm/test.idx'");
+   unlink("shm/test.idx");
+   rmdir("shm");
+
+   // The segment of a file that was rewritten is stale.
+   write_index("test.idx", &(index_t) {
+      .bwt = BWT, .occ = occ, .csa = csa });
+   redirect_stderr();
+   test_assert(load_index("test.idx", LOAD_SHARED, &idx) == -1);
+   unredirect_stderr();
+   test_assert_stderr("shared memory segment does not match "
+         "file 'test.idx'");
+   test_assert(unshare_index("test.idx") == 0);
+
+   redirect_stderr();
+   test_assert(load_index("test.idx", LOAD_SHARED, &idx) == -1);
+   unredirect_stderr();
+   test_assert_stderr("cannot open shared memory segment 'test.idx'");
+
+   redirect_stderr();
+   test_assert(load_index("no such file", LOAD_POPULATE, &idx) == -1);
+   unredirect_stderr();
+   test_assert_stderr("cannot open file 'no such file'");
+
+   unlink("test.idx");
+   free(lut);
+   free(csa);
+   free(occ);
+   free(BWT);
+
+}
+
+
 // Test cases for export.
 const test_case_t test_cases_bwt[] = {
    {"compute_sa",         test_compute_sa},
+   {"compute_sa_mt",      test_compute_sa_mt},
+   {"compute_sa_ext",     test_compute_sa_ext},
+   {"sort_blocks",        test_sort_blocks},
    {"compress_sa",        test_compress_sa},
    {"create_bwt",         test_create_bwt},
    {"write_occ_blocks",   test_write_occ_blocks},
+   {"occ_word",           test_occ_word},
    {"create_occ",         test_create_occ},
+   {"create_occ_mt",      test_create_occ_mt},
+   {"create_index",       test_create_index},
    {"get_rank",           test_get_rank},
+   {"layout_occ",         test_layout_occ},
+   {"occ_super",          test_occ_super},
+   {"pack_occ",           test_pack_occ},
+   {"get_rank_range",     test_get_rank_range},
+   {"rank_kernel",        test_rank_kernel},
    {"fill_lut",           test_fill_lut},
+   {"lookup_lut",         test_lookup_lut},
    {"backward_search",    test_backward_search},
+   {"backward_search_batch", test_backward_search_batch},
    {"query_csa",          test_query_csa},
+   {"translate_pos",      test_translate_pos},
+   {"locate",             test_locate},
+   {"count_hits",         test_count_hits},
+   {"write_index",        test_write_index},
+   {"load_index",         test_load_index},
    {NULL, NULL},
 };